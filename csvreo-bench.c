@@ -0,0 +1,557 @@
+/*******************************************************************************
+ *
+ * This file is free software. You can redistribute it and/or modify it
+ * under the terms of the FreeBSD License which follows.
+ * -----------------------------------------------------------------------------
+ * Copyright (c) 2013, Arkansas Research Center (arc.arkansas.gov)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * -----------------------------------------------------------------------------
+ *
+ * csvreo-bench: generates a deterministic synthetic input and times a set of
+ * representative csvreo jobs on it, one JSON object per job on stdout.
+ *
+ *    cc -O2 -o csvreo-bench csvreo-bench.c
+ *    ./csvreo-bench --csvreo ./csvreo --rows 2M --cols 40 -- --threads 4
+ *    ./csvreo-bench --csvreo ./csvreo --quotes 0 -- --threads 4
+ *
+ * Arguments after -- are passed to every csvreo run.  The second line times
+ * input without a quote anywhere, where --threads can only find the records
+ * of a buffer from the buffer before it.
+ *
+ ******************************************************************************/
+
+#include <time.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define true  1
+#define false 0
+
+#define DEFAULT_ROWS    1000000
+#define DEFAULT_COLS    20
+#define DEFAULT_REPEAT  3
+#define MAX_ARGS        64
+
+#define ERR_CODE_AOK 0  /* success (a-OK) */
+#define ERR_CODE_MEM 8  /* Memory error */
+#define ERR_CODE_FIL 9  /* File error */
+#define ERR_CODE_OPT 11 /* Invalid option value */
+#define ERR_CODE_RUN 12 /* A csvreo run failed */
+
+#define OPT_CSVREO   256
+#define OPT_ROWS     257
+#define OPT_COLS     258
+#define OPT_LEN      259
+#define OPT_QUOTES   260
+#define OPT_NEWLINES 261
+#define OPT_SEED     262
+#define OPT_REPEAT   263
+#define OPT_KEEP     264
+#define OPT_STDIN    265
+
+struct option long_options[] =
+{
+   {"csvreo",    required_argument, 0, OPT_CSVREO},
+   {"rows",      required_argument, 0, OPT_ROWS},
+   {"cols",      required_argument, 0, OPT_COLS},
+   {"field-len", required_argument, 0, OPT_LEN},
+   {"quotes",    required_argument, 0, OPT_QUOTES},
+   {"newlines",  required_argument, 0, OPT_NEWLINES},
+   {"seed",      required_argument, 0, OPT_SEED},
+   {"repeat",    required_argument, 0, OPT_REPEAT},
+   {"keep",      required_argument, 0, OPT_KEEP},
+   {"stdin",     no_argument,       0, OPT_STDIN},
+   {"delim",     required_argument, 0, 'd'},
+   {"help",      no_argument,       0, 'h'},
+   {0, 0, 0, 0}
+};
+
+//shape of the synthetic input
+struct generator
+{
+	size_t rows;            //number of records
+	size_t cols;            //fields per record
+	size_t min_len;         //shortest field
+	size_t max_len;         //longest field
+	double quotes;          //fraction of fields that are quoted
+	double newlines;        //fraction of quoted fields holding a newline
+	uint64_t state;         //xorshift state, seeded from --seed
+	char delim;
+};
+
+//one csvreo job and what it cost
+struct job
+{
+	const char* name;
+	const char* args[MAX_ARGS];
+	size_t num_args;
+	double seconds;         //best wall-clock time over the repeats
+	long peak_rss;          //largest maximum resident set size, in KiB
+};
+
+void usage(int code);
+size_t countAssign(char *optarg, const char *name);
+double rateAssign(char *optarg, const char *name);
+uint64_t gen_next(struct generator *g);
+size_t gen_below(struct generator *g, size_t n);
+void gen_field(struct generator *g, FILE *out);
+off_t gen_file(struct generator *g, const char *path);
+void job_add(struct job *j, const char *arg);
+void job_run(struct job *j, const char *csvreo, const char *input, int use_stdin,
+			 char **extra, int num_extra, size_t repeat);
+
+int main(int argc, char** argv)
+{
+	int ch;
+	size_t ndx;
+	size_t repeat = DEFAULT_REPEAT;
+	const char* csvreo = "./csvreo";
+	char* keep = NULL;
+	int use_stdin = false;
+	char path[] = "/tmp/csvreo-bench-XXXXXX";
+	char key[32];
+	off_t bytes;
+	int fd;
+	struct generator gen;
+	struct job jobs[5];
+
+	gen.rows = DEFAULT_ROWS;
+	gen.cols = DEFAULT_COLS;
+	gen.min_len = 0;
+	gen.max_len = 16;
+	gen.quotes = 0.1;
+	gen.newlines = 0.01;
+	gen.state = 1;
+	gen.delim = '|';
+
+	while((ch = getopt_long(argc, argv, "d:h", long_options, NULL)) != -1)
+	{
+		switch(ch)
+		{
+			case OPT_CSVREO:
+				csvreo = optarg;
+			break;
+
+			case OPT_ROWS:
+				gen.rows = countAssign(optarg, "rows");
+			break;
+
+			case OPT_COLS:
+				gen.cols = countAssign(optarg, "cols");
+			break;
+
+			case OPT_LEN:
+				//MIN:MAX, or a single length
+				if(sscanf(optarg, "%zu:%zu", &gen.min_len, &gen.max_len) == 1)
+				{
+					gen.max_len = gen.min_len;
+				}
+				if(gen.min_len > gen.max_len)
+				{
+					fprintf(stderr, "ERROR: invalid value %s for --field-len.\n", optarg);
+					exit(ERR_CODE_OPT);
+				}
+			break;
+
+			case OPT_QUOTES:
+				gen.quotes = rateAssign(optarg, "quotes");
+			break;
+
+			case OPT_NEWLINES:
+				gen.newlines = rateAssign(optarg, "newlines");
+			break;
+
+			case OPT_SEED:
+				gen.state = strtoull(optarg, NULL, 10);
+				if(gen.state == 0)
+				{
+					gen.state = 1;
+				}
+			break;
+
+			case OPT_REPEAT:
+				repeat = countAssign(optarg, "repeat");
+			break;
+
+			case OPT_KEEP:
+				keep = optarg;
+			break;
+
+			case OPT_STDIN:
+				use_stdin = true;
+			break;
+
+			case 'd':
+				gen.delim = optarg[0];
+			break;
+
+			case 'h':
+				usage(ERR_CODE_AOK);
+			break;
+
+			default:
+				usage(ERR_CODE_OPT);
+		}
+	}
+
+	if(keep == NULL)
+	{
+		fd = mkstemp(path);
+		if(fd < 0)
+		{
+			perror("ERROR while creating the input");
+			exit(ERR_CODE_FIL);
+		}
+		close(fd);
+	}
+	bytes = gen_file(&gen, keep ? keep : path);
+
+	//the jobs every run is compared on
+	for(ndx = 0; ndx < 5; ++ndx)
+	{
+		jobs[ndx].num_args = 0;
+		jobs[ndx].seconds = 0;
+		jobs[ndx].peak_rss = 0;
+	}
+
+	jobs[0].name = "all";
+	job_add(&jobs[0], "-a");
+
+	jobs[1].name = "reverse";
+	job_add(&jobs[1], "-r");
+
+	//a narrow extract from the middle of the record
+	jobs[2].name = "narrow";
+	snprintf(key, sizeof(key), "-k%zu", (gen.cols + 1) / 2);
+	job_add(&jobs[2], strdup(key));
+	job_add(&jobs[2], "-k1");
+
+	jobs[3].name = "fanout";
+	job_add(&jobs[3], "-f/dev/null");
+	job_add(&jobs[3], "-a");
+	job_add(&jobs[3], "-f/dev/null");
+	job_add(&jobs[3], "-k2");
+	job_add(&jobs[3], "-k1");
+	job_add(&jobs[3], "-f/dev/null");
+	job_add(&jobs[3], "-r");
+
+	jobs[4].name = "redelim";
+	job_add(&jobs[4], "-a");
+	job_add(&jobs[4], "-D,");
+	job_add(&jobs[4], "-Q'");
+
+	for(ndx = 0; ndx < 5; ++ndx)
+	{
+		job_run(&jobs[ndx], csvreo, keep ? keep : path, use_stdin,
+				argv + optind, argc - optind, repeat);
+
+		printf("{\"job\":\"%s\",\"rows\":%zu,\"cols\":%zu,\"bytes\":%lld,"
+			   "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"rows_per_s\":%.0f,"
+			   "\"peak_rss_kb\":%ld}\n",
+			   jobs[ndx].name, gen.rows, gen.cols, (long long)bytes,
+			   jobs[ndx].seconds,
+			   bytes / 1e6 / jobs[ndx].seconds,
+			   gen.rows / jobs[ndx].seconds,
+			   jobs[ndx].peak_rss);
+		fflush(stdout);
+	}
+
+	if(keep == NULL)
+	{
+		unlink(path);
+	}
+
+	return 0;
+}
+
+void usage(int code)
+{
+   printf("\n");
+   printf("******************************************************\n");
+   printf("*                                                    *\n");
+   printf("* csvreo-bench                                       *\n");
+   printf("*                                                    *\n");
+   printf("* Writes a synthetic input and times csvreo -a, -r,  *\n");
+   printf("* a narrow -k set, a three file fan-out and a        *\n");
+   printf("* delimiter change on it.  Each job prints one JSON  *\n");
+   printf("* line with its wall time, MB/s, rows/s and peak     *\n");
+   printf("* RSS.  Arguments after -- go to every csvreo run.   *\n");
+   printf("*                                                    *\n");
+   printf("* Arguments:                                         *\n");
+   printf("* --csvreo Path of the binary.  Default ./csvreo     *\n");
+   printf("*                                                    *\n");
+   printf("* --rows, --cols Size of the input; K, M and G       *\n");
+   printf("*   suffixes are accepted.  Defaults are 1M and 20.  *\n");
+   printf("*                                                    *\n");
+   printf("* --field-len MIN:MAX Range of field lengths.        *\n");
+   printf("*   Default is 0:16.                                 *\n");
+   printf("*                                                    *\n");
+   printf("* --quotes Fraction of fields that are quoted and    *\n");
+   printf("*   hold delimiters and escaped quotes.  Default 0.1 *\n");
+   printf("*                                                    *\n");
+   printf("* --newlines Fraction of quoted fields holding a     *\n");
+   printf("*   newline.  Default is 0.01.                       *\n");
+   printf("*                                                    *\n");
+   printf("* --delim (-d) Delimiter of the input.  Default |    *\n");
+   printf("*                                                    *\n");
+   printf("* --seed Seed of the generator.  Default is 1.       *\n");
+   printf("*                                                    *\n");
+   printf("* --repeat Runs per job; the fastest is reported.    *\n");
+   printf("*   Default is 3.                                    *\n");
+   printf("*                                                    *\n");
+   printf("* --keep PATH Writes the input to PATH and leaves    *\n");
+   printf("*   it there, instead of a temporary file.           *\n");
+   printf("*                                                    *\n");
+   printf("* --stdin Feeds the input on stdin rather than with  *\n");
+   printf("*   --input.                                         *\n");
+   printf("*                                                    *\n");
+   printf("* --help (-h) Displays this message and exits.       *\n");
+   printf("*                                                    *\n");
+   printf("******************************************************\n\n");
+
+   exit(code);
+}
+
+size_t countAssign(char *optarg, const char *name)
+{
+	char *end;
+	unsigned long long value = strtoull(optarg, &end, 10);
+
+	//optional binary suffix
+	switch(toupper((unsigned char)*end))
+	{
+		case 'K': value <<= 10; ++end; break;
+		case 'M': value <<= 20; ++end; break;
+		case 'G': value <<= 30; ++end; break;
+	}
+
+	if(end == optarg || *end != '\0' || value == 0)
+	{
+		fprintf(stderr, "ERROR: invalid value %s for --%s.\n", optarg, name);
+		exit(ERR_CODE_OPT);
+	}
+
+	return (size_t)value;
+}
+
+double rateAssign(char *optarg, const char *name)
+{
+	char *end;
+	double value = strtod(optarg, &end);
+
+	if(end == optarg || *end != '\0' || value < 0 || value > 1)
+	{
+		fprintf(stderr, "ERROR: invalid value %s for --%s.\n", optarg, name);
+		exit(ERR_CODE_OPT);
+	}
+
+	return value;
+}
+
+//xorshift64*, so a seed gives the same input everywhere
+uint64_t gen_next(struct generator *g)
+{
+	g->state ^= g->state >> 12;
+	g->state ^= g->state << 25;
+	g->state ^= g->state >> 27;
+	return g->state * 0x2545F4914F6CDD1DULL;
+}
+
+size_t gen_below(struct generator *g, size_t n)
+{
+	return (size_t)(gen_next(g) % n);
+}
+
+void gen_field(struct generator *g, FILE *out)
+{
+	static const char plain[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+	size_t len = g->min_len + gen_below(g, g->max_len - g->min_len + 1);
+	int quoted = (gen_next(g) >> 11) * (1.0 / 9007199254740992.0) < g->quotes;
+	int newline = quoted && (gen_next(g) >> 11) * (1.0 / 9007199254740992.0) < g->newlines;
+	size_t ndx;
+
+	if(!quoted)
+	{
+		for(ndx = 0; ndx < len; ++ndx)
+		{
+			putc(plain[gen_below(g, sizeof(plain) - 1)], out);
+		}
+		return;
+	}
+
+	//quoted fields carry what quoting is for: delimiters and quotes
+	putc('"', out);
+	for(ndx = 0; ndx < len; ++ndx)
+	{
+		switch(gen_below(g, 8))
+		{
+			case 0:
+				putc(g->delim, out);
+			break;
+
+			case 1:
+				fputs("\"\"", out);
+			break;
+
+			default:
+				putc(plain[gen_below(g, sizeof(plain) - 1)], out);
+		}
+	}
+	if(newline)
+	{
+		putc('\n', out);
+	}
+	putc('"', out);
+}
+
+//write the input; returns its size
+off_t gen_file(struct generator *g, const char *path)
+{
+	FILE* out = fopen(path, "w");
+	struct stat st;
+	size_t row;
+	size_t col;
+
+	if(out == NULL)
+	{
+		fprintf(stderr, "ERROR: File %s failed to open.\n", path);
+		exit(ERR_CODE_FIL);
+	}
+
+	for(row = 0; row < g->rows; ++row)
+	{
+		gen_field(g, out);
+		for(col = 1; col < g->cols; ++col)
+		{
+			putc(g->delim, out);
+			gen_field(g, out);
+		}
+		putc('\n', out);
+	}
+
+	if(fclose(out) != 0 || stat(path, &st) != 0)
+	{
+		fprintf(stderr, "ERROR: failed writing %s.\n", path);
+		exit(ERR_CODE_FIL);
+	}
+
+	return st.st_size;
+}
+
+void job_add(struct job *j, const char *arg)
+{
+	if(j->num_args == MAX_ARGS - 1)
+	{
+		fprintf(stderr, "ERROR: too many arguments for job %s.\n", j->name);
+		exit(ERR_CODE_OPT);
+	}
+	j->args[j->num_args++] = arg;
+}
+
+//run a job repeat times with its output discarded, keeping the best time
+void job_run(struct job *j, const char *csvreo, const char *input, int use_stdin,
+			 char **extra, int num_extra, size_t repeat)
+{
+	const char* argv[2 * MAX_ARGS];
+	struct timespec start;
+	struct timespec stop;
+	struct rusage usage;
+	double seconds;
+	size_t argc = 0;
+	size_t run;
+	size_t ndx;
+	int status;
+	int fd;
+	pid_t pid;
+
+	argv[argc++] = csvreo;
+	argv[argc++] = "-p0";
+	if(!use_stdin)
+	{
+		argv[argc++] = "-i";
+		argv[argc++] = input;
+	}
+	for(ndx = 0; ndx < j->num_args; ++ndx)
+	{
+		argv[argc++] = j->args[ndx];
+	}
+	for(ndx = 0; ndx < (size_t)num_extra && argc < 2 * MAX_ARGS - 1; ++ndx)
+	{
+		argv[argc++] = extra[ndx];
+	}
+	argv[argc] = NULL;
+
+	for(run = 0; run < repeat; ++run)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pid = fork();
+		if(pid < 0)
+		{
+			perror("ERROR while starting csvreo");
+			exit(ERR_CODE_RUN);
+		}
+		if(pid == 0)
+		{
+			fd = open(use_stdin ? input : "/dev/null", O_RDONLY);
+			dup2(fd, STDIN_FILENO);
+			fd = open("/dev/null", O_WRONLY);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			execv(csvreo, (char* const*)argv);
+			_exit(127);
+		}
+
+		while(wait4(pid, &status, 0, &usage) < 0 && errno == EINTR);
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			fprintf(stderr, "ERROR: job %s failed (status %d).\n", j->name,
+					WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+			exit(ERR_CODE_RUN);
+		}
+
+		seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+		if(run == 0 || seconds < j->seconds)
+		{
+			j->seconds = seconds;
+		}
+		if(usage.ru_maxrss > j->peak_rss)
+		{
+			j->peak_rss = usage.ru_maxrss;
+		}
+	}
+}
@@ -0,0 +1,486 @@
+/*******************************************************************************
+ *
+ * This file is free software. You can redistribute it and/or modify it
+ * under the terms of the FreeBSD License which follows.
+ * -----------------------------------------------------------------------------
+ * Copyright (c) 2013, Arkansas Research Center (arc.arkansas.gov)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * -----------------------------------------------------------------------------
+ *
+ * csvreo-test: checks of the libcsvreo API, chiefly that jobs which fail
+ * return the right code and can still be freed.  Prints one line per check
+ * and exits with the number that failed.
+ *
+ *    cc -O2 -o csvreo-test csvreo-test.c libcsvreo.c -lpthread -lz
+ *    ./csvreo-test
+ *
+ * Build with -DHAVE_ZSTD and -lzstd as well to check zstd output and input
+ * instead of the errors of a build without them.
+ *
+ ******************************************************************************/
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csvreo.h"
+
+static const char input[] = "a|b|c\nd|e|f\n";
+
+static int failed = 0;
+
+//report a check and count it if it failed
+static void check(const char *name, int ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+	failed += !ok;
+}
+
+//an output with no keys fails when the input starts
+static void test_no_keys(void)
+{
+	struct csvreo* job = csvreo_new();
+
+	csvreo_output_memory(job);
+	check("no keys: feed fails", csvreo_feed(job, input, 10) == ERR_CODE_NKY);
+	check("no keys: job stays failed", csvreo_finish(job) == ERR_CODE_NKY);
+	csvreo_free(job);
+}
+
+//a delimiter equal to the quote fails when the input starts
+static void test_bad_delim(void)
+{
+	struct csvreo* job = csvreo_new();
+
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_KEYS, "1");
+	csvreo_option(job, CSVREO_DELIM, "\"");
+	check("bad delimiter: feed fails", csvreo_feed(job, input, sizeof(input) - 1) == ERR_CODE_EQD);
+	csvreo_free(job);
+}
+
+//partitions without a column to pick them by fail while planning
+static void test_bad_partitions(void)
+{
+	struct csvreo* job = csvreo_new();
+
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_PARTS, "4");
+	check("partitions: finish fails", csvreo_finish(job) == ERR_CODE_OPT);
+	csvreo_free(job);
+}
+
+//keys start at 1
+static void test_key_range(void)
+{
+	struct csvreo* job = csvreo_new();
+
+	csvreo_output_memory(job);
+	check("key out of range: option fails", csvreo_option(job, CSVREO_KEYS, "0") == ERR_CODE_KOR);
+	check("key out of range: job stays failed", csvreo_finish(job) == ERR_CODE_KOR);
+	csvreo_free(job);
+}
+
+//a callback that refuses the rows fails the job
+static int refuse(void *ctx, const char *buff, size_t len)
+{
+	(void)ctx;
+	(void)buff;
+	(void)len;
+	return 1;
+}
+
+static void test_callback_error(void)
+{
+	struct csvreo* job = csvreo_new();
+
+	csvreo_output_callback(job, refuse, NULL);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_feed(job, input, sizeof(input) - 1);
+	check("refusing callback: finish fails", csvreo_finish(job) == ERR_CODE_FIL);
+	csvreo_free(job);
+}
+
+//a refusing callback fails a run with threads the same way, without ending
+//the process, and the caller's signals are as they were
+static void test_run_error(const char *name, const char *threads, int inputs)
+{
+	char path[] = "/tmp/csvreo-test-XXXXXX";
+	char what[128];
+	struct csvreo* job;
+	sigset_t mask;
+	FILE* file;
+	int fd = mkstemp(path);
+	int ndx;
+
+	file = (fd < 0) ? NULL : fdopen(fd, "w");
+	if(file == NULL)
+	{
+		check("run: temporary input", 0);
+		return;
+	}
+	for(ndx = 0; ndx < 100000; ++ndx)
+	{
+		fprintf(file, "%d|b|c\n", ndx);
+	}
+	fclose(file);
+
+	job = csvreo_new();
+	csvreo_output_callback(job, refuse, NULL);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_THREADS, threads);
+	csvreo_option(job, CSVREO_PROGRESS, "1");
+	for(ndx = 0; ndx < inputs; ++ndx)
+	{
+		csvreo_option(job, CSVREO_INPUT, path);
+	}
+	snprintf(what, sizeof(what), "%s: run fails", name);
+	check(what, csvreo_run(job) == ERR_CODE_FIL);
+	snprintf(what, sizeof(what), "%s: job stays failed", name);
+	check(what, csvreo_finish(job) == ERR_CODE_FIL);
+	pthread_sigmask(SIG_BLOCK, NULL, &mask);
+	snprintf(what, sizeof(what), "%s: SIGUSR1 not left blocked", name);
+	check(what, !sigismember(&mask, SIGUSR1));
+	csvreo_free(job);
+	unlink(path);
+}
+
+//an output that cannot be written fails the job from its writer threads,
+//compressing or not, which have no call of their own to return it from
+static void test_write_error(const char *name, const char *file, int threads)
+{
+	char dir[] = "/tmp/csvreo-test-XXXXXX";
+	char path[64];
+	char what[128];
+	char line[32];
+	struct csvreo* job;
+	int ndx;
+	int code;
+
+	if(mkdtemp(dir) == NULL)
+	{
+		check("write error: temporary directory", 0);
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	if(symlink("/dev/full", path) != 0)
+	{
+		check("write error: link to /dev/full", 0);
+		rmdir(dir);
+		return;
+	}
+
+	job = csvreo_new();
+	csvreo_option(job, CSVREO_FILE, path);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_QUEUE, "2");
+	csvreo_option(job, CSVREO_ZTHREADS, threads ? "2" : "1");
+	for(ndx = 0, code = ERR_CODE_AOK; ndx < 200000 && code == ERR_CODE_AOK; ++ndx)
+	{
+		snprintf(line, sizeof(line), "%d|b|c\n", ndx);
+		code = csvreo_feed(job, line, strlen(line));
+	}
+	if(code == ERR_CODE_AOK)
+	{
+		code = csvreo_finish(job);
+	}
+	snprintf(what, sizeof(what), "%s: job fails", name);
+	check(what, code == ERR_CODE_FIL);
+	csvreo_free(job);
+
+	unlink(path);
+	rmdir(dir);
+}
+
+//an input that fails to open is returned too, with SIGUSR1, which is
+//blocked before the input is opened, given back
+static void test_open_error(void)
+{
+	struct csvreo* job = csvreo_new();
+	sigset_t mask;
+
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_PROGRESS, "1");
+	csvreo_option(job, CSVREO_INPUT, "/nonexistent/csvreo-test.csv");
+	check("missing input: run fails", csvreo_run(job) == ERR_CODE_FIL);
+	pthread_sigmask(SIG_BLOCK, NULL, &mask);
+	check("missing input: SIGUSR1 not left blocked", !sigismember(&mask, SIGUSR1));
+	csvreo_free(job);
+}
+
+//a .zst output and zstd input are read back as written, or, built without
+//zstd, fail: the output before its file is created and the input when read
+static void test_zstd(void)
+{
+	char dir[] = "/tmp/csvreo-test-XXXXXX";
+	char path[64];
+	struct csvreo* job;
+	const char* rows;
+	size_t len = 0;
+	int code;
+
+	if(mkdtemp(dir) == NULL)
+	{
+		check("zstd: temporary directory", 0);
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/out.csv.zst", dir);
+
+	job = csvreo_new();
+	code = csvreo_option(job, CSVREO_FILE, path);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_feed(job, input, sizeof(input) - 1);
+	code = (code == ERR_CODE_AOK) ? csvreo_finish(job) : code;
+	csvreo_free(job);
+#ifdef HAVE_ZSTD
+	check("zstd: output written", code == ERR_CODE_AOK);
+#else
+	FILE* file;
+
+	check("zstd: output fails without zstd", code == ERR_CODE_OPT);
+	check("zstd: no output file left", access(path, F_OK) != 0);
+
+	//a zstd frame header and nothing the reader gets to
+	file = fopen(path, "w");
+	if(file != NULL)
+	{
+		fwrite("\x28\xb5\x2f\xfd\x20\x0c", 1, 6, file);
+		fclose(file);
+	}
+#endif
+
+	job = csvreo_new();
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_INPUT, path);
+	code = csvreo_run(job);
+	rows = csvreo_memory(job, 0, &len);
+#ifdef HAVE_ZSTD
+	check("zstd: input read back", code == ERR_CODE_AOK && rows != NULL && len == 24 &&
+		  memcmp(rows, "\"a\"|\"b\"|\"c\"\n\"d\"|\"e\"|\"f\"\n", len) == 0);
+#else
+	(void)rows;
+	check("zstd: input fails without zstd", code == ERR_CODE_FIL);
+#endif
+	csvreo_free(job);
+
+	unlink(path);
+	rmdir(dir);
+}
+
+//and a job that works writes its rows
+static void test_memory(void)
+{
+	struct csvreo* job = csvreo_new();
+	const char* rows;
+	size_t len = 0;
+
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_KEYS, "3");
+	csvreo_option(job, CSVREO_KEYS, "1");
+	csvreo_feed(job, input, 7);
+	csvreo_feed(job, input + 7, sizeof(input) - 8);
+	check("memory: finish works", csvreo_finish(job) == ERR_CODE_AOK);
+	rows = csvreo_memory(job, 0, &len);
+	check("memory: rows written", rows != NULL && len == 16 && memcmp(rows, "\"c\"|\"a\"\n\"f\"|\"d\"\n", len) == 0);
+	csvreo_free(job);
+}
+
+//a column past the end of a row is empty: -a writes as many columns as
+//the first row has, but keys, tests and sort columns past them still see
+//the longer rows' fields
+static void test_short_rows(void)
+{
+	static const char ragged[] = "a|b\nc|d|e\n";
+	struct csvreo* job = csvreo_new();
+	const char* rows;
+	size_t len = 0;
+
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_WHERE, "3=e");
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_WHERE, "9!=x");
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_KEYS, "1");
+	csvreo_option(job, CSVREO_KEYS, "3");
+	csvreo_output_memory(job);
+	csvreo_option(job, CSVREO_REVERSE, NULL);
+	csvreo_option(job, CSVREO_SORT_BY, "3");
+	csvreo_feed(job, ragged, sizeof(ragged) - 1);
+	check("short rows: finish works", csvreo_finish(job) == ERR_CODE_AOK);
+	rows = csvreo_memory(job, 0, &len);
+	check("short rows: tested past the first row", rows != NULL && len == 8 && memcmp(rows, "\"c\"|\"d\"\n", len) == 0);
+	rows = csvreo_memory(job, 1, &len);
+	check("short rows: missing column is empty", rows != NULL && len == 16 && memcmp(rows, "\"a\"|\"b\"\n\"c\"|\"d\"\n", len) == 0);
+	rows = csvreo_memory(job, 2, &len);
+	check("short rows: missing key is empty", rows != NULL && len == 15 && memcmp(rows, "\"a\"|\"\"\n\"c\"|\"e\"\n", len) == 0);
+	rows = csvreo_memory(job, 3, &len);
+	check("short rows: sorted past the first row", rows != NULL && len == 16 && memcmp(rows, "\"b\"|\"a\"\n\"d\"|\"c\"\n", len) == 0);
+	csvreo_free(job);
+}
+
+//a partitioned job spreads its rows over the files, and frees them all
+static void test_partitions(void)
+{
+	char dir[] = "/tmp/csvreo-test-XXXXXX";
+	char name[64];
+	char line[64];
+	struct csvreo* job;
+	FILE* file;
+	int rows = 0;
+	int ndx;
+
+	if(mkdtemp(dir) == NULL)
+	{
+		check("partitions: temporary directory", 0);
+		return;
+	}
+	snprintf(name, sizeof(name), "%s/pt_%%02d.csv", dir);
+
+	job = csvreo_new();
+	csvreo_option(job, CSVREO_FILE, name);
+	csvreo_option(job, CSVREO_ALL, NULL);
+	csvreo_option(job, CSVREO_PART_BY, "2");
+	csvreo_option(job, CSVREO_PARTS, "4");
+	for(ndx = 0; ndx < 1000; ++ndx)
+	{
+		snprintf(line, sizeof(line), "a|%d|c\n", ndx);
+		csvreo_feed(job, line, strlen(line));
+	}
+	check("partitions: finish works", csvreo_finish(job) == ERR_CODE_AOK);
+	csvreo_free(job);
+
+	for(ndx = 0; ndx < 4; ++ndx)
+	{
+		snprintf(name, sizeof(name), "%s/pt_%02d.csv", dir, ndx);
+		file = fopen(name, "r");
+		while(file != NULL && fgets(line, sizeof(line), file) != NULL)
+		{
+			++rows;
+		}
+		if(file != NULL)
+		{
+			fclose(file);
+		}
+		unlink(name);
+	}
+	rmdir(dir);
+	check("partitions: every row written once", rows == 1000);
+}
+
+//rows split across the buffers of a threaded run come out as they went in,
+//with or without quotes, and also where a buffer is wholly inside a quoted
+//field holding newlines but no quotes
+static void test_threads(const char *name, int quoted)
+{
+	char path[] = "/tmp/csvreo-test-XXXXXX";
+	char what[128];
+	const char* rows;
+	char* expect = NULL;
+	size_t expect_len = 0;
+	size_t len = 0;
+	struct csvreo* job;
+	FILE* file;
+	int fd = mkstemp(path);
+	int ndx;
+	int pass;
+
+	file = (fd < 0) ? NULL : fdopen(fd, "w");
+	if(file == NULL)
+	{
+		check("threads: temporary input", 0);
+		return;
+	}
+	for(ndx = 0; ndx < 2000; ++ndx)
+	{
+		if(quoted && ndx % 100 == 0)
+		{
+			fprintf(file, "%d|\"%0*d\n%0*d\"|c\n", ndx, 3000, ndx, 3000, ndx);
+		}
+		else
+		{
+			fprintf(file, "%d|b|c\n", ndx);
+		}
+	}
+	fclose(file);
+
+	//one thread first, for the rows the threaded run should write
+	for(pass = 0; pass < 2; ++pass)
+	{
+		job = csvreo_new();
+		csvreo_output_memory(job);
+		csvreo_option(job, CSVREO_ALL, NULL);
+		csvreo_option(job, CSVREO_THREADS, pass ? "4" : "1");
+		csvreo_option(job, CSVREO_BUFSIZE, "1K");
+		csvreo_option(job, CSVREO_INPUT, path);
+		snprintf(what, sizeof(what), "%s: run works", name);
+		check(what, csvreo_run(job) == ERR_CODE_AOK);
+		rows = csvreo_memory(job, 0, &len);
+		if(pass == 0)
+		{
+			expect = malloc(len + 1);
+			memcpy(expect, rows, len);
+			expect_len = len;
+		}
+		else
+		{
+			snprintf(what, sizeof(what), "%s: rows as with one thread", name);
+			check(what, len == expect_len && memcmp(rows, expect, len) == 0);
+		}
+		csvreo_free(job);
+	}
+	free(expect);
+	unlink(path);
+}
+
+int main(void)
+{
+	test_no_keys();
+	test_bad_delim();
+	test_bad_partitions();
+	test_key_range();
+	test_callback_error();
+	test_run_error("run", "1", 1);
+	test_run_error("threaded run", "4", 1);
+	test_run_error("run over inputs", "2", 3);
+	test_open_error();
+	test_write_error("full disk", "out.csv", 0);
+	test_write_error("full disk, compressed", "out.csv.gz", 1);
+	test_zstd();
+	test_memory();
+	test_short_rows();
+	test_partitions();
+	test_threads("threads without quotes", 0);
+	test_threads("threads with quoted newlines", 1);
+
+	return failed;
+}
@@ -0,0 +1,182 @@
+/*******************************************************************************
+ *
+ * This file is free software. You can redistribute it and/or modify it
+ * under the terms of the FreeBSD License which follows.
+ * -----------------------------------------------------------------------------
+ * Copyright (c) 2013, Arkansas Research Center (arc.arkansas.gov)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * -----------------------------------------------------------------------------
+ *
+ * libcsvreo: the csvreo engine as a library.  A job is set up with the same
+ * options as the command line, then either reads its input itself
+ * (csvreo_run) or is handed the input piece by piece (csvreo_feed and
+ * csvreo_finish).  Jobs share nothing, so any number of them can run at
+ * once, each in its own thread.
+ *
+ *    struct csvreo* job = csvreo_new();
+ *    csvreo_output_memory(job);
+ *    csvreo_option(job, CSVREO_KEYS, "3");
+ *    csvreo_option(job, CSVREO_KEYS, "1");
+ *    csvreo_feed(job, buff, len);        (as often as needed)
+ *    csvreo_finish(job);
+ *    rows = csvreo_memory(job, 0, &len);
+ *    csvreo_free(job);
+ *
+ * Every call returns ERR_CODE_AOK or the code of the error, which
+ * csvreo_error() describes.  A job that has failed stays failed.
+ *
+ ******************************************************************************/
+
+#ifndef CSVREO_H
+#define CSVREO_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//results of the csvreo_* calls, which the command line exits with
+#define ERR_CODE_AOK 0  /* success (a-OK) */
+#define ERR_CODE_CSV 1  /* Error in the libcsv parser */
+#define ERR_CODE_XKY 2  /* Too many keys (eXtra KeYs) */
+#define ERR_CODE_NKY 3  /* No key */
+#define ERR_CODE_KOR 4  /* Key out of range */
+#define ERR_CODE_BDQ 5  /* Invalid quote */
+#define ERR_CODE_BDD 6  /* Invalid delimiter */
+#define ERR_CODE_EQD 7  /* Equal quote and delimiter */
+#define ERR_CODE_MEM 8  /* Memory error */
+#define ERR_CODE_FIL 9  /* File error */
+#define ERR_CODE_PTH 10 /* Thread error */
+#define ERR_CODE_OPT 11 /* Invalid option value */
+
+//options of csvreo_option(); the letters are the command line's, whose
+//usage text describes them all
+#define CSVREO_QUOTE     'q'
+#define CSVREO_OUTQUOTE  'Q'
+#define CSVREO_DELIM     'd'
+#define CSVREO_OUTDELIM  'D'
+#define CSVREO_KEYS      'k'
+#define CSVREO_FILE      'f'
+#define CSVREO_INPUT     'i'
+#define CSVREO_PROGRESS  'p'
+#define CSVREO_REVERSE   'r'
+#define CSVREO_ALL       'a'
+#define CSVREO_BUFFERS   256
+#define CSVREO_BUFSIZE   257
+#define CSVREO_THREADS   258
+#define CSVREO_QUEUE     259
+#define CSVREO_STATS     260
+#define CSVREO_INTERVAL  261
+#define CSVREO_ZTHREADS  262
+#define CSVREO_WHERE     263
+#define CSVREO_PARTS     264
+#define CSVREO_PART_BY   265
+#define CSVREO_INDEX     266
+#define CSVREO_ROWS      267
+#define CSVREO_ORDERED   268
+#define CSVREO_UNORDERED 269
+#define CSVREO_HEADER    270
+#define CSVREO_URING     271
+#define CSVREO_SORT_BY   272
+#define CSVREO_SORT_MEM  273
+#define CSVREO_DISTINCT  274
+#define CSVREO_DISTINCT_MEM 275
+#define CSVREO_FORMAT    276
+
+//binary outputs (--format).  Numbers are little-endian and every file
+//starts with its 8-byte magic.
+//
+//lenprefix: rows back to back, each a u32 field count and then, per field,
+//its u32 length and bytes.
+//
+//columnar: chunks of rows back to back.  A chunk is a u64 of the bytes
+//after it, a u32 row count r, a u32 column count c, c u64 ends of the
+//column blocks (counted from the end of the ends) and the blocks.  A block
+//is r u32 field lengths and then the fields.  Readers can skip from chunk
+//to chunk and read any column of a chunk on its own.
+#define CSVREO_LENPREFIX_MAGIC "CSVREOL1"
+#define CSVREO_COLUMNAR_MAGIC  "CSVREOC1"
+
+//number of input buffers in the ring
+#define CSVREO_DEFAULT_BUFFERS 4
+
+//buffers of rows each output's writer thread may fall behind by
+#define CSVREO_DEFAULT_QUEUE 4
+
+struct csvreo;
+
+//receives an output's rows, in order; anything but 0 fails the job
+typedef int (*csvreo_write)(void *ctx, const char *buff, size_t len);
+
+//a job with no outputs; NULL if it could not be allocated
+struct csvreo* csvreo_new(void);
+
+//set an option, as the command line would; value is copied, and is NULL
+//for options without one.  Options only apply before the input is read.
+int csvreo_option(struct csvreo *job, int option, const char *value);
+
+//start an output that is kept in memory (see csvreo_memory), passed to
+//write, or written to fd; the options that follow apply to it as they
+//would to a --file
+int csvreo_output_memory(struct csvreo *job);
+int csvreo_output_callback(struct csvreo *job, csvreo_write write, void *ctx);
+int csvreo_output_fd(struct csvreo *job, int fd);
+
+//parse the next len bytes of the input; records may be cut off anywhere
+int csvreo_feed(struct csvreo *job, const char *buff, size_t len);
+
+//end of input: write the rows held back and wait for the outputs
+int csvreo_finish(struct csvreo *job);
+
+//read the --input files (or stdin) with the job's threads, as the command
+//line does.  An error in any of the threads stops them all, and is returned
+//once they have.  Progress messages are off unless CSVREO_PROGRESS is set.
+int csvreo_run(struct csvreo *job);
+
+//the rows written to output number n (from 0, in the order outputs were
+//started) if it is kept in memory
+const char* csvreo_memory(struct csvreo *job, size_t n, size_t *len);
+
+//records read so far
+size_t csvreo_rows(struct csvreo *job);
+
+//seconds csvreo_run() took
+double csvreo_time(struct csvreo *job);
+
+//print the --stats report of a finished csvreo_run() to stderr, if asked for
+void csvreo_report(struct csvreo *job);
+
+//what the last error was
+const char* csvreo_error(struct csvreo *job);
+
+//close the job's files and free it
+void csvreo_free(struct csvreo *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,7915 @@
+/*******************************************************************************
+ * $Id: csvreo.c 4504 2015-04-03 19:44:23Z agille $
+ *
+ * This file is free software. You can redistribute it and/or modify it
+ * under the terms of the FreeBSD License which follows.
+ * -----------------------------------------------------------------------------
+ * Copyright (c) 2013, Arkansas Research Center (arc.arkansas.gov)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * -----------------------------------------------------------------------------
+ *
+ * The csvreo engine, built into the command line (mt-csvreo.c) or into any
+ * program that includes csvreo.h, which describes the interface.
+ *
+ ******************************************************************************/
+
+//O_DIRECT
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <zlib.h>
+#include "csvreo.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+//io_uring is used through its system calls, so only the kernel's header is
+//needed
+#if defined(__linux__)
+#define HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__x86_64__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+//the characters libcsv's rules treat specially, besides the delimiter and
+//the quote
+#define CSV_TAB    0x09
+#define CSV_SPACE  0x20
+#define CSV_CR     0x0d
+#define CSV_LF     0x0a
+
+//1 MiB
+#define BUFSIZE 1048576
+
+//rows parsed before the outputs write them
+#define BATCH_ROWS 2048
+#define BATCH_CELLS 65536
+
+//bytes of fields a batch holds before it is written early
+#define BATCH_BYTES (16 << 20)
+
+//size of the blocks field bytes are taken from; longer requests than a
+//quarter of a block get a block of their own
+#define ARENA_BLOCK (1 << 20)
+
+//blocks an arena keeps for the next batch
+#define ARENA_KEEP 4
+
+//bytes of formatted rows each output holds before writing them
+#define OUTBUF_SIZE 1048576
+
+//seconds between progress messages
+#define DEFAULT_INTERVAL 5.0
+
+//seconds between looks at the row count when --progress gives one
+#define PROGRESS_POLL 0.1
+
+//default --sort-mem, shared by the sorted outputs
+#define DEFAULT_SORT_MEM (256 << 20)
+
+//default --distinct-mem, shared by the --distinct outputs
+#define DEFAULT_DISTINCT_MEM (256 << 20)
+
+//fingerprint slots a --distinct output starts with
+#define DISTINCT_SLOTS 4096
+
+//spill files of a --distinct output at each level, picked by 6 bits of the
+//fingerprint; a level's files are split again at the next one if need be
+#define DISTINCT_FANOUT 64
+#define DISTINCT_LEVELS 10
+
+//reads and slots of an --io-uring=direct input are aligned to this
+#define DIRECT_ALIGN 4096
+
+//records between the offsets kept by --build-index
+#define DEFAULT_INDEX_EVERY 65536
+
+//bytes of rows a worker holds for an input whose turn to be written (in
+//--ordered runs of several inputs) has not come yet
+#define FILE_HOLD (64 << 20)
+
+//first line of an index file
+#define INDEX_MAGIC "csvreo-index 1"
+
+#define true  1
+#define false 0
+
+//--where tests
+#define WHERE_EQ        0   /* N=value */
+#define WHERE_NE        1   /* N!=value */
+#define WHERE_PREFIX    2   /* N~prefix */
+#define WHERE_NO_PREFIX 3   /* N!~prefix */
+
+#define CODEC_NONE  0       /* plain bytes */
+#define CODEC_GZIP  1       /* gzip (.gz) */
+#define CODEC_ZSTD  2       /* Zstandard (.zst) */
+
+//compression levels of .gz and .zst outputs
+#define GZIP_LEVEL  6
+#define ZSTD_LEVEL  3
+
+#define FORMAT_CSV       0  /* delimited text */
+#define FORMAT_LENPREFIX 1  /* --format=lenprefix */
+#define FORMAT_COLUMNAR  2  /* --format=columnar */
+
+#define STATS_OFF   0       /* no --stats report */
+#define STATS_TEXT  1       /* --stats */
+#define STATS_JSON  2       /* --stats=json */
+
+//what a job has been handed so far
+#define URING_OFF    0      /* input is mapped or read with read() */
+#define URING_ON     1      /* --io-uring */
+#define URING_DIRECT 2      /* --io-uring=direct */
+
+#define JOB_SETUP   0       /* options and outputs */
+#define JOB_FEEDING 1       /* input, through csvreo_feed() */
+#define JOB_DONE    2       /* the end of its input */
+
+//first record start of a slot in parallel mode
+#define START_UNKNOWN -2    /* slot not scanned yet */
+#define START_NONE    -1    /* no record starts in the slot */
+
+//piece size used while the first row is still being looked for
+#define WIDTH_PIECE 65536
+
+//parser states tracked by the record boundary scan (see scan_next)
+#define ST_ROW      0       /* between rows */
+#define ST_FIELD    1       /* between fields */
+#define ST_UNQUOTED 2       /* inside an unquoted field */
+#define ST_QUOTED   3       /* inside a quoted field */
+#define ST_END      4       /* quote seen in a quoted field */
+#define ST_END_SP   5       /* as above, followed by spaces */
+#define NUM_STATES  6
+
+struct data;
+struct row_batch;
+
+//where a job's errors go.  The csvreo_* call running in owner catches
+//them and returns the code.  The threads it starts record the first error
+//here instead, the others stop on seeing it, and the call returns it once
+//they have (see fail() and failure_record()).
+struct failure
+{
+    jmp_buf jump;                   //where the running call catches errors
+    pthread_t owner;                //thread of that call
+    int armed;                      //a call is catching errors
+    int code;                       //ERR_CODE_* of the error (AOK: none yet)
+    char message[256];              //what went wrong
+};
+
+//formatted rows on their way to a file; outputs to the same file share one
+struct out_buffer
+{
+    char* buff;                     //rows not written yet
+    size_t len;                     //used size of buff
+    size_t capacity;                //size of buff
+    int fd;                         //where buff is written (-1: kept in memory)
+    struct out_queue* queue;        //writer thread for fd (NULL: written in place)
+    size_t flushed;                 //bytes handed on from buff so far
+    int codec;                      //CODEC_* fd is written in
+    csvreo_write write;             //called with the rows instead of writing fd (NULL: fd)
+    void* ctx;                      //passed to write
+    struct failure* failure;        //where errors writing buff go
+};
+
+//bounded queue of full buffers between the parser and an output's writer
+//threads; buffers are swapped in and out so none are allocated once it runs
+//
+//A plain file has one writer.  A compressed file has a pool of them: each
+//takes the next buffer, compresses it on its own and waits for the buffers
+//queued before it to be written before writing its own.
+struct out_queue
+{
+    struct out_buffer* blocks;      //buffers waiting to be written
+    size_t num_blocks;              //size of the queue
+    size_t head;                    //next buffer to write
+    size_t count;                   //buffers waiting
+    size_t claimed;                 //buffers from head on taken by a writer
+    size_t written;                 //buffers written so far
+    size_t packed;                  //buffers compressed so far
+    int fd;                         //where the buffers are written
+    int codec;                      //CODEC_* the buffers are compressed with
+    int done;                       //no more buffers will be queued
+    size_t stalls;                  //times the parser found the queue full
+    int error;                      //ERR_CODE_* of a writer's error; later buffers are dropped
+    char message[256];              //what went wrong
+    struct failure* failure;        //the job's, which a writer's error is handed to
+    pthread_t* ids;                 //writer threads
+    size_t num_workers;             //size of the above array
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;       //signalled when a buffer is queued or done is set
+    pthread_cond_t not_full;        //signalled when a buffer has been written
+    pthread_cond_t turn;            //signalled when written changes
+};
+
+//the input as the reader sees it; compressed input is decompressed into the
+//ring's buffers by the reader
+struct in_codec
+{
+    int kind;                       //CODEC_* of the input
+    FILE* file;                     //where bytes are read from
+    int fd;                         //file's descriptor, read with read(2)
+    const char* map;                //mapped compressed input (NULL: read from file)
+    size_t map_len;                 //size of the mapping
+    size_t map_pos;                 //mapped bytes handed to the decompressor
+    char* in;                       //bytes read from file
+    const char* next;               //bytes read but not used yet
+    size_t avail;                   //number of the above
+    int open;                       //a gzip member or zstd frame is not finished
+    struct failure* failure;        //where read errors go
+    z_stream z;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zd;
+#endif
+};
+
+//an input file read with io_uring (--io-uring): every free slot of the ring
+//has a read in flight, and slots are published in order as they complete
+struct uring_reader
+{
+    int fd;                         //the io_uring
+    int file;                       //the input
+    unsigned* sq_head;              //submission queue, shared with the kernel
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;              //completion queue, shared with the kernel
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;                   //the mappings of the above
+    size_t sq_map_len;
+    void* cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+    unsigned entries;               //size of the submission queue
+    int fixed;                      //the slots are registered buffers
+    int direct;                     //file was opened with O_DIRECT
+    size_t size;                    //size of the input
+    size_t* got;                    //bytes read into each slot so far
+    size_t submitted;               //slots with a read submitted
+    size_t published;               //slots handed to the parser
+    size_t in_flight;               //reads not completed
+    unsigned pending;               //reads queued but not submitted
+    struct failure* failure;        //where read errors go
+};
+
+//a test a row must pass to be written to an output (--where)
+struct where_clause
+{
+    size_t column;                  //column tested
+    int test;                       //WHERE_*
+    const char* value;              //bytes compared with the field
+    size_t len;                     //size of value
+};
+
+//structure for each output file
+struct output_file
+{
+    FILE* outfile;                  //the file being written to
+    short deferred;                 //outfile is opened by plan_partitions()
+    int* keyorder;                  //array of keys, in the specified order
+    size_t num_keys;                //number of keys selected (above array size)
+    struct output_file* next;       //next output file structure
+    struct out_buffer* sink;        //formatted rows not written yet
+    struct out_buffer* own_sink;    //the sink this output made and frees (NULL: it shares one)
+    short interleave;               //sink is shared, so rows go a row at a time
+	short rev;						//reverse flag
+	short all;						//all flag
+    int format;                     //FORMAT_*
+    char outdelim;                  //delimiter for output
+    char outquote;                  //quote for output
+    void (*emit)(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);  //writes rows (see plan_emit)
+    size_t* columns;                //columns emit writes, in order
+    size_t num_columns;             //size of the above array
+    struct where_clause* where;     //tests every written row passes
+    size_t num_where;               //size of the above array
+    struct out_buffer* parts;       //one buffer per partition (NULL: not partitioned)
+    size_t num_parts;               //--partitions
+    size_t* part_columns;           //--partition-by columns, hashed to pick a part
+    size_t num_part_columns;        //size of the above array
+    size_t* sort_columns;           //--sort-by columns, in order
+    size_t num_sort_columns;        //size of the above array
+    struct sort_state* sort;        //the sorter rows go to (NULL: not sorted)
+    short distinct;                 //--distinct
+    struct distinct_state* dedup;   //the filter rows go to (NULL: not --distinct)
+    const char* name;               //file name, for --stats
+    size_t bytes;                   //bytes formatted (--stats only)
+    size_t part_bytes;              //bytes of every partition at the last count
+    double emit_time;               //seconds spent formatting (--stats only)
+};
+
+//counters for --stats; every parsing thread keeps its own, added up at the end
+struct stage_stats
+{
+    size_t bytes_read;              //input bytes
+    double read_time;               //seconds blocked reading the input
+    double parse_time;              //seconds parsing, formatting included
+    size_t full_waits;              //times the reader found every buffer in use
+    size_t empty_waits;             //times a parser found no buffer to parse
+    size_t peak_arena;              //most bytes the field arena held
+    size_t peak_fields;             //most columns the field arrays held
+    size_t peak_carry;              //largest record carried between buffers
+};
+
+//record start offsets of an input (--build-index); entry i is where record
+//i * every + 1 starts
+struct row_index
+{
+    size_t every;                   //records between kept offsets
+    size_t* offsets;                //kept offsets
+    size_t len;                     //used size of offsets
+    size_t capacity;                //size of offsets
+    size_t rows;                    //records in the input (once read in full)
+    struct failure* failure;        //where errors growing offsets go
+};
+
+//a block of an arena; data runs on past the end of the struct
+struct arena_block
+{
+    struct arena_block* next;       //the block taken before this one
+    size_t size;                    //bytes of data
+    char data[];
+};
+
+//bump allocator for the bytes of the rows in a batch; everything taken
+//from it is given back at once when the batch has been written
+struct arena
+{
+    struct arena_block* blocks;     //blocks in use, the current one first
+    struct arena_block* spare;      //blocks kept from the last batch
+    size_t num_spare;               //number of spare blocks
+    char* next;                     //free space in the current block
+    char* end;                      //end of the current block
+    size_t held;                    //bytes of the blocks in use
+    size_t peak;                    //most bytes held at once
+    struct failure* failure;        //where allocation errors go
+};
+
+//rows parsed but not written yet, a column at a time: the field in column c
+//of row r is len[c * capacity + r] bytes from start[c * capacity + r]
+struct row_batch
+{
+    size_t num_rows;                //rows held
+    size_t capacity;                //rows held before the batch is written
+    size_t num_columns;             //columns held for each row
+    size_t width;                   //columns -a and -r write (the first row's)
+    const char** start;             //where each field is (in the arena)
+    size_t* len;                    //length of each field
+    uint32_t* selected;             //rows an output writes, in order
+    uint32_t* sorted;               //the above, sorted by partition
+    uint32_t* part;                 //partition of each selected row
+    size_t* part_rows;              //end of each partition's rows in sorted
+};
+
+//sort records of a --sort-by output held in memory; each record is a
+//uint32_t of the bytes after it, a uint32_t field count, a uint32_t length
+//per field and then the fields, the sort columns first
+struct sort_run
+{
+    char* buff;                     //records back to back
+    size_t len;                     //used size of buff
+    size_t capacity;                //size of buff
+    size_t* records;                //offset of each whole record in buff
+    size_t num_records;             //used size of records
+    size_t records_capacity;        //size of records
+    size_t num_keys;                //sort columns at the front of each record
+};
+
+//the sorter of a --sort-by output: emit_records() writes records to the
+//output's sink in place of rows, and the sink hands them on to sort_write()
+//in input order.  They are sorted in runs of up to half the budget; a full
+//run is sorted and written to a temporary file by a thread of its own while
+//the next run fills, and the runs are merged into the output at the end.
+struct sort_state
+{
+    struct out_buffer records;      //sink of the output while it is sorted
+    struct out_buffer* dest;        //the output's own sink
+    void (*format)(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);  //writes a merged row
+    size_t budget;                  //bytes of records and offsets a run holds
+    struct sort_run runs[2];        //the run filling and the one spilling
+    int filling;                    //index of the run filling
+    size_t scanned;                 //bytes of that run split into records
+    FILE** spills;                  //sorted runs written out, in input order
+    size_t num_spills;              //size of the above array
+    pthread_t spiller;              //thread writing out the other run
+    int spilling;                   //spiller is running
+    int error;                      //ERR_CODE_* of the spiller's error
+    char message[256];              //what went wrong
+    struct failure* failure;        //where errors go
+};
+
+//the filter of a --distinct output: emit_records() writes records to the
+//output's sink in place of rows, and the sink hands them on to
+//distinct_write() in input order.  A record goes on only if the 128-bit
+//fingerprint of its fields is not in an open-addressing set yet.  Once the
+//set has grown to the budget, records it does not hold are spilled to files
+//by fingerprint, and each file is filtered with a set of its own at the end.
+struct distinct_state
+{
+    struct out_buffer records;      //sink of the output while it is filtered
+    struct out_buffer* dest;        //the output's own sink, or its sorter's
+    int sorted;                     //dest is a sorter's, which takes records
+    struct output_file flat;        //the output, writing rows to dest
+    void (*format)(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);  //writes a first occurrence
+    size_t num_keys;                //sort columns at the front of each record, not compared
+    uint64_t* seen;                 //fingerprints, two words a slot (0, 0: empty)
+    size_t capacity;                //slots in seen
+    size_t count;                   //fingerprints in seen
+    size_t max_slots;               //most slots the budget allows
+    FILE* spills[DISTINCT_LEVELS][DISTINCT_FANOUT];  //records not checked yet (NULL: none)
+    char* carry;                    //a record cut off where the sink was flushed
+    size_t carry_len;               //used size of carry
+    size_t carry_capacity;          //size of carry
+    char* buff;                     //the record read from a spill file
+    size_t buff_capacity;           //size of buff
+    struct row_batch row;           //a record as a row, for format
+    size_t row_columns;             //columns row has room for
+    struct failure* failure;        //where errors go
+};
+
+struct data
+{
+    FILE* infile;                   //the input file
+    struct output_file* outputs;    //linked list of output file structures
+    size_t current_field;           //the current field being processed
+    size_t* field_lengths;          //the length of each field in the field array
+    const char** view;              //where each field's bytes are (a buffer or the input)
+    struct arena arena;             //bytes of the rows in the batch
+    char* row_buff;                 //fields of the current row, back to back (in the arena)
+    size_t row_len;                 //bytes used in row_buff
+    size_t row_capacity;            //size of row_buff
+	struct output_file* last;		//most recently allocated output struct
+	size_t row;						//number of rows read thus far
+    size_t progress;                //0 turns progress messages off, 1 times them, more counts rows
+	size_t num_fields;              //the number of columns in the file
+	size_t field_slots;             //number of columns the field arrays hold
+	size_t needed;                  //columns up to the last one any output uses
+	size_t reach;                   //columns up to the last one any output names
+	char* wanted;                   //which of those columns are used (NULL: all)
+	short width_known;              //num_fields is final (set by the first row)
+	short transcode;                //rows skip the batch (see plan_transcode)
+	short stats;                    //STATS_* report wanted
+	struct stage_stats timing;      //--stats counters of this thread
+	size_t offset;                  //input offset of the buffer being parsed
+	struct row_index* index;        //record starts seen (NULL: not indexing)
+	size_t first_row;               //first record written (--rows, from 1)
+	size_t num_rows;                //records written from first_row on
+	int stop;                       //records past --rows have been reached
+	struct row_batch* batch;        //rows waiting to be written (NULL until the first)
+    char delim;                     //input file delimiter
+    char quote;                     //quote character
+    struct failure* failure;        //where errors go
+};
+
+//bounded ring of input buffers shared by the reader and the parser threads
+//slots are named by sequence number; slot seq lives in buff[seq % num_slots]
+struct buffer_ring
+{
+	char** buff;			//slot buffers
+	size_t* size;			//used size of each slot (not the capacity)
+	size_t num_slots;		//number of slots in the ring
+	size_t slot_size;		//capacity of each slot
+	size_t filled;			//slots published by the reader
+	size_t claimed;			//slots handed to a parser
+	size_t released;		//slots given back to the reader
+	int done;				//set once the reader has hit end of input
+	int failed;				//set once the job has failed; every wait ends
+	int views;				//slots point into a mapped input instead of owned buffers
+	size_t* offset;			//input offset of each slot
+	size_t bytes;			//bytes published so far
+	size_t full_waits;		//times the reader waited for a free slot
+	size_t empty_waits;		//times a parser waited for a filled slot
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;	//signalled when a slot is filled or input ends
+	pthread_cond_t not_full;	//signalled when a slot is released
+};
+
+//the start of a record cut off at the end of one buffer, kept until the
+//buffers after it finish the record
+struct view_stream
+{
+	char* carry;			//bytes of the unfinished record
+	size_t len;				//used size of carry
+	size_t capacity;		//size of carry
+	unsigned char state;	//boundary scan state at the end of carry
+	size_t offset;			//input offset of the next buffer
+	size_t carry_offset;	//input offset of carry
+	struct failure* failure;	//where errors growing carry go
+	unsigned char table[NUM_STATES][256];	//boundary scan transitions
+};
+
+//where the vectorized scan is in the buffer being parsed; the 64 bytes from
+//block on are classified once and then read back as a bit mask
+struct scan_cursor
+{
+	const char* block;		//start of the classified block
+	const char* end;		//end of the buffer
+	uint64_t bits;			//delimiters, quotes and newlines in the block
+	char delim;
+	char quote;
+};
+
+//progress reporter thread; it reads the row and byte counts on a timer
+//(or on SIGUSR1), so the parser never checks for progress itself
+struct progress_report
+{
+	struct data* dat;			//row count and bytes read
+	size_t total;				//input size (0 if not known)
+	double interval;			//seconds between messages
+	size_t every;				//rows between messages instead (0: use interval)
+	size_t next_rows;			//row count of the next of those
+	double start;				//when the run started
+	double last_time;			//when the last message was printed
+	size_t last_rows;			//rows at the last message
+	size_t last_bytes;			//bytes at the last message
+	int done;					//set when the run is over
+	pthread_t id;
+};
+
+struct thread_data
+{
+	struct buffer_ring* ring;	//input buffers filled by job_read()
+	struct view_stream* stream;	//pointer to the struct used by the parser
+	struct data* dat; 		//pointer to data struct used by callbacks
+
+};
+
+//output of one parallel thread, held in memory until its chunk is written
+struct staged_output
+{
+	struct output_file out;		//copy of the real output writing to memory
+	struct output_file* dest;	//the real output
+	struct out_buffer sink;		//memory out writes to, unless shared
+	struct out_buffer* parts;	//memory each partition of out writes to
+};
+
+//state shared by the threads of a --threads run
+//
+//Every slot is scanned by the thread that claims it for the first position
+//where a record starts.  The bytes before that position finish the record
+//begun in an earlier slot, so each chunk runs from the record start of one
+//slot to the record start of the next slot that has one.  Chunks are parsed
+//concurrently and their output is written in input order.
+struct parallel_scan
+{
+	struct buffer_ring* ring;	//input buffers filled by job_read()
+	struct data* dat;			//options, real outputs and the row total
+	long* start;				//first record start of each slot (or START_*)
+	long (*first)[NUM_STATES];	//a slot's first record start for each state it may start in
+	unsigned char (*last)[NUM_STATES];	//the state the slot then ends in
+	short* scanned;				//first and last are set for the slot
+	size_t resolved;			//slot whose start is settled next
+	unsigned char entry;		//parser state at the start of that slot
+	short* parts;				//halves of each slot parsed (2 == done)
+	size_t next_commit;			//slot whose chunk is written next
+	size_t num_fields;			//column count taken from the first row
+	short width_known;			//num_fields is set
+	short contiguous;			//slots are consecutive views of one mapping
+	short aligned;				//every slot starts a record (taken from an index)
+	unsigned char table[NUM_STATES][256];	//boundary scan transitions
+	pthread_mutex_t lock;
+	pthread_cond_t changed;		//a start, the width or next_commit changed
+};
+
+struct parallel_thread
+{
+	struct parallel_scan* ps;
+	struct data dat;			//private copy used by the callbacks
+	struct staged_output* staged;	//one per real output
+	size_t num_staged;
+	struct view_stream stream;
+	pthread_t id;
+};
+
+//state shared by the workers of a run over several inputs
+//
+//Each worker takes the next input not yet taken and parses all of it with
+//a parser of its own.  Inputs are written whole and in order unless the
+//job is --unordered, in which case each worker writes as it goes.
+struct file_pool
+{
+	struct csvreo* job;			//inputs, options and real outputs
+	size_t next;				//input taken next
+	size_t turn;				//input written next (--ordered)
+	size_t num_fields;			//column count taken from the first row
+	short width_known;			//num_fields is set
+	short started;				//the first input's first row has been parsed
+	pthread_mutex_t lock;
+	pthread_cond_t changed;		//turn or started changed
+	pthread_mutex_t write;		//held while staged rows go to the outputs
+};
+
+struct file_worker
+{
+	struct file_pool* pool;
+	struct data dat;			//private copy used by the callbacks
+	struct staged_output* staged;	//one per real output
+	size_t num_staged;
+	struct view_stream stream;
+	char* buff;					//input read from a file that is not mapped
+	size_t counted;				//rows of the current input added to the total
+	struct in_codec input;		//the input being parsed, if it is read
+	int input_open;				//input is set up
+	const char* map;			//mapping of the input being parsed (NULL: none)
+	size_t map_len;				//size of the mapping
+	int writing;				//pool->write is held
+	pthread_t id;
+};
+
+//a job of the library (csvreo.h): the parser's data and what the options
+//set for csvreo_run()
+struct csvreo
+{
+    struct data dat;
+    struct failure failure;         //the job's error; dat.failure points here
+    int state;                      //JOB_*
+    struct view_stream stream;      //input handed to csvreo_feed()
+    char** strings;                 //copies of the option values
+    size_t num_strings;             //size of the above array
+    char* input_path;               //the one --input (NULL: stdin or several)
+    char** inputs;                  //every --input, in order
+    size_t num_inputs;              //size of the above array
+    short unordered;                //--unordered
+    short header;                   //--header
+    struct progress_report progress;    //progress thread
+    int progress_running;           //progress thread was started
+    sigset_t mask;                  //the caller's signals, put back by job_end()
+    int masked;                     //mask was saved
+    char* index_path;               //input_path's index
+    struct row_index* loaded;       //index read from index_path (NULL: none)
+    const char* mapped;             //mapping of the input file (NULL: none)
+    const char* map;                //mapped input that is parsed in place (NULL: read through the buffers)
+    size_t map_len;                 //size of the mapping
+    size_t total;                   //size of the input (0 if not known)
+    struct stat st;                 //the input file, for its index
+    struct in_codec input;          //the input, if it is read
+    int input_open;                 //input is set up
+    struct buffer_ring ring;        //input buffers
+    int ring_open;                  //ring is set up
+    int uring;                      //URING_*
+    struct uring_reader reader;     //the input, if it is read with io_uring
+    int reader_open;                //reader is set up
+    size_t num_buffers;             //--buffers
+    size_t buffer_size;             //--bufsize
+    size_t num_threads;             //--threads (0: not given)
+    size_t queue_blocks;            //--queue
+    size_t compress_threads;        //--compress-threads
+    size_t index_every;             //--build-index (0: no index built)
+    size_t sort_mem;                //--sort-mem
+    size_t distinct_mem;            //--distinct-mem
+    double interval;                //--progress-interval
+    double wall;                    //seconds csvreo_run() took
+    double cpu;                     //processor seconds it took
+};
+
+static void fail(struct failure *f, int code, const char *fmt, ...) __attribute__ ((noreturn, format (printf, 3, 4)));
+static void failure_record(struct failure *f, int code, const char *message);
+static int job_failed(struct failure *f);
+static void thread_unwind(void) __attribute__ ((noreturn));
+static int job_catch(void (*step)(struct csvreo *job), struct csvreo *job);
+static double intervalAssign(char *optarg, struct failure *f);
+static void progress_start(struct progress_report *p, struct data *d, size_t total, double interval, size_t every);
+static void progress_finish(struct progress_report *p);
+static void progress_print(struct progress_report *p, const char *what);
+static void* thread_progress(void* data_ptr);
+static double now(void);
+static void stats_report(struct data *d, double wall, double cpu);
+static void stats_string(const char *s);
+static size_t stats_stalls(struct output_file *o);
+static void check_opts(struct data *o);
+static void plan_columns(struct data *d);
+static void plan_emit(struct data *d);
+static void plan_partitions(struct data *d);
+static void fileAssign(struct data *d, char *optarg);
+static struct output_file* output_new(struct data *d, const char *name);
+static void keyAssign(struct data *d, char *optarg);
+static void whereAssign(struct data *d, char *optarg);
+static void partAssign(struct data *d, char *optarg);
+static void out_field(struct output_file *o, const char *src, size_t n);
+static void out_char(struct output_file *o, char c);
+static void out_reserve(struct out_buffer *b, size_t n);
+static void out_flush(struct out_buffer *b);
+static int out_write(int fd, const char *buff, size_t len);
+static void out_commit(struct out_buffer *dest, struct out_buffer *src);
+static void sink_init(struct out_buffer *b, int fd, int codec, struct failure *f);
+
+/* output writer thread functions */
+static void output_start(struct data *d, size_t num_blocks, size_t num_workers);
+static void output_finish(struct data *d);
+static void queue_start(struct out_buffer *sink, size_t num_blocks, size_t num_workers);
+static void queue_finish(struct out_buffer *sink);
+static void queue_push(struct out_queue *q, struct out_buffer *src);
+static void queue_write(struct out_queue *q, const char *buff, size_t len);
+static void queue_free(struct out_buffer *sink);
+static void* thread_output_write(void* data_ptr);
+static size_t block_compress(int codec, const char *src, size_t len, char **dst, size_t *capacity);
+
+/* compressed input functions */
+static int codec_detect(const unsigned char *p, size_t len);
+static int codec_name(const char *path, struct failure *f);
+static void input_open(struct in_codec *c, FILE *file, const char *map, size_t map_len, struct failure *f);
+static int input_fill(struct in_codec *c);
+static size_t input_raw(struct in_codec *c, char *buff, size_t len, size_t want);
+static int input_ready(struct in_codec *c);
+static size_t input_read(struct in_codec *c, char *buff, size_t len);
+static void input_close(struct in_codec *c);
+static int uring_open(struct uring_reader *u, const char *path, struct buffer_ring *r, int direct, struct failure *f);
+static void uring_read(struct uring_reader *u, struct buffer_ring *r, struct data *d);
+static void uring_queue(struct uring_reader *u, struct buffer_ring *r, size_t seq);
+static void uring_reap(struct uring_reader *u, struct buffer_ring *r);
+static void uring_close(struct uring_reader *u);
+static size_t sizeAssign(char *optarg, const char *name, struct failure *f);
+static void fieldGrow(struct data *d);
+static void rowGrow(struct data *d, size_t n);
+static void arena_init(struct arena *a, struct failure *f);
+static char* arena_alloc(struct arena *a, size_t n);
+static char* arena_grow(struct arena *a, size_t n);
+static void arena_release(struct arena *a, char *p);
+static void arena_reset(struct arena *a);
+static void arena_free(struct arena *a);
+static void* thread_io_scan(void* data_ptr);
+static void io_scan(struct thread_data *data);
+static const char* map_input(struct data *d, char *path, size_t *len);
+
+/* record index functions */
+static struct row_index* index_new(size_t every, struct failure *f);
+static void index_add(struct row_index *ix, size_t offset);
+static void index_note(struct data *d, size_t offset);
+static void index_drop(struct data *d, size_t offset);
+static void index_merge(struct row_index *dest, struct row_index *src, size_t base);
+static size_t index_next(struct row_index *ix, size_t *cursor, size_t offset);
+static void index_save(struct row_index *ix, const char *path, struct stat *st, struct data *d);
+static struct row_index* index_load(const char *path, struct stat *st, struct data *d);
+static void rowsAssign(struct data *d, char *optarg);
+
+/* zero-copy parsing functions */
+static size_t view_parse(struct data *d, const char *buff, size_t len, int final);
+static const char* quoted_view(struct data *d, struct scan_cursor *scan, const char *pos);
+static const char* quoted_copy(struct data *d, const char *pos, const char *end);
+static const char* quoted_skip(struct data *d, struct scan_cursor *scan, const char *pos);
+static const char* record_skip(struct data *d, struct scan_cursor *scan, const char *pos);
+static void field_view(struct data *d, const char *c, size_t n);
+static void stream_init(struct view_stream *s, struct data *d);
+static void stream_parse(struct view_stream *s, const char *buff, size_t len, struct data *d);
+static void stream_carry(struct view_stream *s, const char *buff, size_t len);
+static void stream_fini(struct view_stream *s, struct data *d);
+static void stream_free(struct view_stream *s);
+
+/* vectorized scanning functions */
+static uint64_t classify_tail(const char *p, size_t n, char delim, char quote);
+static uint64_t classify64_scalar(const char *p, char delim, char quote);
+#ifdef SCAN_X86
+static uint64_t classify64_sse2(const char *p, char delim, char quote);
+static uint64_t classify64_avx2(const char *p, char delim, char quote);
+static uint64_t classify64_avx512(const char *p, char delim, char quote);
+#endif
+static void scan_select(void);
+static void scan_init(struct scan_cursor *s, const char *buff, size_t len, struct data *d);
+static void scan_load(struct scan_cursor *s, const char *pos);
+static const char* scan_find(struct scan_cursor *s, const char *pos);
+static void scan_table(unsigned char table[NUM_STATES][256], unsigned char delim, unsigned char quote);
+
+/* buffer ring functions */
+static void ring_init(struct buffer_ring *r, size_t num_slots, size_t slot_size, int views, struct failure *f);
+static long ring_acquire_empty(struct buffer_ring *r);
+static void ring_publish(struct buffer_ring *r, size_t len);
+static void ring_finish(struct buffer_ring *r);
+static void ring_abort(struct buffer_ring *r);
+static long ring_acquire_full(struct buffer_ring *r);
+static int ring_has_slot(struct buffer_ring *r, size_t seq);
+static int ring_slot_free(struct buffer_ring *r, size_t seq, int wait);
+static void ring_release(struct buffer_ring *r);
+static void ring_free(struct buffer_ring *r);
+
+/* parallel parsing functions */
+static void parallel_init(struct parallel_scan *ps, struct buffer_ring *r, struct data *d);
+static void parallel_thread_init(struct parallel_thread *t, struct parallel_scan *ps);
+static unsigned char scan_next(int state, unsigned char c, unsigned char delim, unsigned char quote);
+static void scan_slot(unsigned char table[NUM_STATES][256], unsigned char delim, unsigned char quote,
+			   const char *buff, size_t len, long first[NUM_STATES], unsigned char last[NUM_STATES]);
+static unsigned char scan_run(unsigned char table[NUM_STATES][256], unsigned char delim,
+					   const unsigned char *ubuff, size_t pos, size_t end, unsigned char state, long *row);
+static void parallel_resolve(struct parallel_scan *ps);
+static void parallel_mark(struct parallel_scan *ps, size_t seq, short parts);
+static void parallel_parse(struct parallel_thread *t, char *buff, size_t len);
+static void parallel_width(struct parallel_thread *t);
+static void parallel_chunk(struct parallel_thread *t, size_t seq, long start);
+static void parallel_commit(struct parallel_thread *t, size_t seq, size_t next);
+static void parallel_stats(struct parallel_thread *t);
+static void parallel_free(struct parallel_scan *ps, struct parallel_thread *workers, size_t num_threads);
+static struct staged_output* stage_init(struct data *copy, struct data *d, size_t *num_staged);
+static void stage_commit(struct staged_output *staged, size_t num_staged);
+static void stage_free(struct staged_output *staged, size_t num_staged);
+static void* thread_parallel_scan(void* data_ptr);
+static void parallel_run(struct parallel_thread *t);
+static void parallel_abort(struct parallel_scan *ps);
+
+/* row batch functions */
+static void batch_add(struct data *d);
+static void row_transcode(struct data *d);
+static void plan_transcode(struct data *d);
+static void plan_interleave(struct data *d);
+static struct row_batch* batch_new(struct data *d);
+static void batch_emit(struct data *d);
+static void batch_free(struct data *d);
+static size_t batch_bytes(struct output_file *o);
+static size_t batch_select(struct output_file *o, struct row_batch *b);
+static int row_selected(struct output_file *o, struct row_batch *b, uint32_t row);
+static void batch_partition(struct output_file *o, struct row_batch *b, size_t count);
+
+/* row writers picked by plan_emit() */
+static void emit_all(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);
+static void emit_reverse(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);
+static void emit_range(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);
+static void emit_columns(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);
+static void emit_lenprefix(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);
+static void emit_columnar(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);
+static size_t output_column(struct output_file *o, struct row_batch *b, size_t field);
+static void put_u32(char *p, uint32_t value);
+static void put_u64(char *p, uint64_t value);
+static void formatAssign(struct data *d, char *optarg);
+static void format_header(struct output_file *o, struct out_buffer *sink);
+
+/* --sort-by functions */
+static void sortAssign(struct data *d, char *optarg);
+static void plan_sort(struct data *d, size_t budget);
+static void emit_records(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n);
+static size_t record_column(struct output_file *o, struct row_batch *b, size_t field);
+static void record_row(struct row_batch *row, size_t *columns, const char *record, size_t num_keys, struct failure *f);
+static int sort_write(void *ctx, const char *buff, size_t len);
+static void sort_grow(struct sort_run *run, size_t n, size_t limit, struct failure *f);
+static void sort_spill(struct sort_state *s);
+static void sort_join(struct sort_state *s);
+static void* thread_sort_spill(void* data_ptr);
+static void sort_records(struct sort_run *run);
+static int sort_compare(const void *a, const void *b, void *ctx);
+static int record_compare(const char *a, const char *b, size_t num_keys);
+static FILE* sort_tempfile(void);
+static const char* sort_read(FILE *file, char **buff, size_t *capacity);
+static int merge_before(const char **current, size_t a, size_t b, size_t num_keys);
+static void sort_finish(struct output_file *o, int stats);
+static void sort_free(struct output_file *o);
+
+/* --distinct functions */
+static void plan_distinct(struct data *d, size_t budget);
+static int distinct_write(void *ctx, const char *buff, size_t len);
+static void distinct_carry(struct distinct_state *s, const char *buff, size_t len);
+static void distinct_record(struct distinct_state *s, const char *record, size_t level);
+static void record_fingerprint(const char *record, size_t num_keys, uint64_t *h);
+static void fingerprint_mix(uint64_t *h, const char *p, size_t len);
+static int distinct_add(struct distinct_state *s, const uint64_t *h);
+static void distinct_grow(struct distinct_state *s, size_t capacity);
+static void distinct_emit(struct distinct_state *s, const char *record);
+static void distinct_drain(struct distinct_state *s, size_t level);
+static void distinct_finish(struct output_file *o, int stats);
+static void distinct_free(struct output_file *o);
+static struct out_buffer* output_sink(struct output_file *o);
+
+/* callback functions */
+static void cb2(int, void *);
+
+/* library functions (the rest are in csvreo.h) */
+static int job_leave(struct csvreo *job);
+static void job_arm(struct csvreo *job);
+static char* job_string(struct csvreo *job, const char *value);
+static void job_plan(struct csvreo *job);
+static void job_start(struct csvreo *job);
+static void job_option(struct csvreo *job, int option, const char *value);
+static void job_open(struct csvreo *job);
+static void inputs_open(struct csvreo *job);
+static void job_read(struct csvreo *job);
+static void job_begin(struct csvreo *job);
+static void job_end(struct csvreo *job);
+static void job_stop(struct csvreo *job);
+
+/* several input functions */
+static void files_read(struct csvreo *job);
+static void* thread_file_scan(void* data_ptr);
+static void file_parse(struct file_worker *w, size_t file);
+static void file_commit(struct file_worker *w, size_t file, int last);
+static void file_stats(struct file_worker *w);
+static void file_close(struct file_worker *w);
+static void file_abort(struct file_pool *pool);
+
+//where fail() sends the errors of a thread csvreo_run() started (NULL: none)
+static __thread jmp_buf* caught = NULL;
+
+//classifies 64 bytes at a time; scan_select() picks one for the processor
+static uint64_t (*classify64)(const char *p, char delim, char quote) = classify64_scalar;
+static pthread_once_t classify_once = PTHREAD_ONCE_INIT;
+
+static void cb2(int n __attribute__ ((unused)), void *vp)
+{
+	struct data* d = vp;
+
+	/* maybe flag to suppress lines with incorrect number of fields
+	if(d->current_field != num_fields)
+	{
+		//do something based on options
+	}
+	*/
+
+	//the progress thread reads the count while it changes
+	__atomic_store_n(&d->row, d->row + 1, __ATOMIC_RELAXED);
+
+	//records outside --rows are counted but not written
+	if(d->row - d->first_row < d->num_rows)
+	{
+		if(d->transcode)
+		{
+			row_transcode(d);
+		}
+		else
+		{
+			batch_add(d);
+		}
+	}
+	else if(d->row > d->first_row)
+	{
+		__atomic_store_n(&d->stop, true, __ATOMIC_RELAXED);
+	}
+
+	d->current_field = 0;
+	d->row_len = 0;
+	d->width_known = true;
+}
+
+//copy the columns of the current row that outputs use into the batch, and
+//hand the batch to the outputs once it is full.  Fields already copied into
+//the row buffer are left there; the next row's buffer starts after them.
+static void batch_add(struct data *d)
+{
+	struct row_batch* b = d->batch;
+	const char** start;
+	size_t* len;
+	size_t fields;
+	size_t ndx;
+
+	if(b == NULL)
+	{
+		b = d->batch = batch_new(d);
+	}
+
+	//columns missing from a short row are empty
+	fields = (d->current_field < b->num_columns) ? d->current_field : b->num_columns;
+	start = b->start + b->num_rows;
+	len = b->len + b->num_rows;
+	for(ndx = 0; ndx < fields; ++ndx, start += b->capacity, len += b->capacity)
+	{
+		*len = d->field_lengths[ndx];
+		if(*len > 0 && (d->wanted == NULL || d->wanted[ndx]))
+		{
+			if(d->view[ndx] >= d->row_buff && d->view[ndx] < d->row_buff + d->row_len)
+			{
+				*start = d->view[ndx];
+			}
+			else
+			{
+				*start = memcpy(arena_alloc(&d->arena, *len), d->view[ndx], *len);
+			}
+		}
+		else
+		{
+			*start = "";
+			*len = 0;
+		}
+	}
+	for(; ndx < b->num_columns; ++ndx, start += b->capacity, len += b->capacity)
+	{
+		*start = "";
+		*len = 0;
+	}
+	d->row_buff += d->row_len;
+	d->row_capacity -= d->row_len;
+	d->row_len = 0;
+
+	//rows with huge fields are written sooner so memory use stays bounded
+	if(++b->num_rows == b->capacity || d->arena.held > BATCH_BYTES)
+	{
+		batch_emit(d);
+	}
+}
+
+//write the row to every output straight from its fields, which only plain
+//-a outputs allow: the fields need no copying into the arena to outlive
+//the input buffer, and the output writes them all in order, quoting each
+//and doubling only the quotes of fields that have any
+static void row_transcode(struct data *d)
+{
+	struct output_file* output;
+	struct out_buffer* sink;
+	size_t fields = d->num_fields;
+	size_t present = (d->current_field < fields) ? d->current_field : fields;
+	size_t size = 3 * fields + 1;
+	size_t written;
+	size_t rest;
+	size_t len;
+	size_t ndx;
+	double start;
+	char* dest;
+
+	for(ndx = 0; ndx < present; ++ndx)
+	{
+		size += d->field_lengths[ndx];
+	}
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		start = d->stats ? now() : 0;
+		sink = output->sink;
+		written = sink->flushed + sink->len;
+		out_reserve(sink, size);
+		dest = sink->buff + sink->len;
+		for(ndx = 0, rest = size; ndx < fields; ++ndx)
+		{
+			if(ndx > 0)
+			{
+				*dest++ = output->outdelim;
+			}
+			len = (ndx < present) ? d->field_lengths[ndx] : 0;
+			rest -= len + 3;
+			if(len > 0 && memchr(d->view[ndx], output->outquote, len) != NULL)
+			{
+				sink->len = dest - sink->buff;
+				out_field(output, d->view[ndx], len);
+				out_reserve(sink, rest);
+				dest = sink->buff + sink->len;
+				continue;
+			}
+			*dest++ = output->outquote;
+			if(len > 0)
+			{
+				memcpy(dest, d->view[ndx], len);
+				dest += len;
+			}
+			*dest++ = output->outquote;
+		}
+		*dest++ = '\n';
+		sink->len = dest - sink->buff;
+
+		if(d->stats)
+		{
+			output->emit_time += now() - start;
+			output->bytes += sink->flushed + sink->len - written;
+		}
+	}
+}
+
+//a batch holds the columns up to the last one used (every column for -a
+//and -r, which only write as many as the first row has, and any column
+//past those that a key or test names)
+static struct row_batch* batch_new(struct data *d)
+{
+	struct row_batch* b = malloc(sizeof(struct row_batch));
+	struct output_file* output;
+	size_t parts = 0;
+
+	if(b == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+	}
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		if(output->num_parts > parts)
+		{
+			parts = output->num_parts;
+		}
+	}
+
+	b->width = d->num_fields;
+	b->num_columns = (d->needed == SIZE_MAX) ? d->num_fields : d->needed;
+	if(b->num_columns < d->reach)
+	{
+		b->num_columns = d->reach;
+	}
+	b->num_rows = 0;
+
+	//wide rows get fewer rows per batch so that a row's cells stay close
+	b->capacity = BATCH_CELLS / (b->num_columns ? b->num_columns : 1);
+	if(b->capacity > BATCH_ROWS)
+	{
+		b->capacity = BATCH_ROWS;
+	}
+	else if(b->capacity < 16)
+	{
+		b->capacity = 16;
+	}
+	b->start = malloc((b->num_columns ? b->num_columns : 1) * b->capacity * sizeof(char*));
+	b->len = malloc((b->num_columns ? b->num_columns : 1) * b->capacity * sizeof(size_t));
+	b->selected = malloc(b->capacity * sizeof(uint32_t));
+	b->sorted = malloc(b->capacity * sizeof(uint32_t));
+	b->part = malloc(b->capacity * sizeof(uint32_t));
+	b->part_rows = malloc((parts + 1) * sizeof(size_t));
+	if(b->start == NULL || b->len == NULL || b->selected == NULL ||
+	   b->sorted == NULL || b->part == NULL || b->part_rows == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+	}
+
+	return b;
+}
+
+//write the rows of the batch to every output: each output's --where tests
+//pick its rows a column at a time, --partitions sorts them by file, and the
+//row writer then runs over all of them in one call.  Outputs sharing a
+//buffer instead write each row in turn, so their rows stay interleaved.
+static void batch_emit(struct data *d)
+{
+	struct row_batch* b = d->batch;
+	struct output_file* output;
+	struct out_buffer* sink;
+	size_t count;
+	size_t written;
+	double start;
+	size_t ndx;
+	uint32_t row;
+	int interleave = false;
+
+	if(b == NULL || b->num_rows == 0)
+	{
+		return;
+	}
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		if(output->interleave)
+		{
+			interleave = true;
+			continue;
+		}
+
+		start = d->stats ? now() : 0;
+		sink = output->sink;
+		written = sink->flushed + sink->len;
+
+		count = batch_select(output, b);
+		if(output->num_parts == 0)
+		{
+			output->emit(output, b, b->selected, count);
+		}
+		else
+		{
+			//the row writer writes to o->sink, so each partition takes
+			//its place for its rows and the output's own is put back
+			batch_partition(output, b, count);
+			for(ndx = 0, count = 0; ndx < output->num_parts; count = b->part_rows[ndx++])
+			{
+				if(b->part_rows[ndx] > count)
+				{
+					output->sink = &output->parts[ndx];
+					output->emit(output, b, b->sorted + count, b->part_rows[ndx] - count);
+				}
+			}
+			output->sink = sink;
+		}
+
+		if(d->stats)
+		{
+			output->emit_time += now() - start;
+
+			//a partitioned output's bytes are spread over its parts
+			if(output->num_parts == 0)
+			{
+				output->bytes += sink->flushed + sink->len - written;
+			}
+			else
+			{
+				output->bytes += batch_bytes(output) - output->part_bytes;
+				output->part_bytes = batch_bytes(output);
+			}
+		}
+	}
+
+	for(row = 0; interleave && row < b->num_rows; ++row)
+	{
+		for(output = d->outputs; output != NULL; output = output->next)
+		{
+			if(!output->interleave || !row_selected(output, b, row))
+			{
+				continue;
+			}
+
+			start = d->stats ? now() : 0;
+			sink = output->sink;
+			written = sink->flushed + sink->len;
+			output->emit(output, b, &row, 1);
+			if(d->stats)
+			{
+				output->emit_time += now() - start;
+				output->bytes += sink->flushed + sink->len - written;
+			}
+		}
+	}
+
+	//the row buffer came from the arena too
+	b->num_rows = 0;
+	arena_reset(&d->arena);
+	d->row_buff = NULL;
+	d->row_len = 0;
+	d->row_capacity = 0;
+}
+
+//free the batch and the field storage of d
+static void batch_free(struct data *d)
+{
+	if(d->batch != NULL)
+	{
+		free(d->batch->start);
+		free(d->batch->len);
+		free(d->batch->selected);
+		free(d->batch->sorted);
+		free(d->batch->part);
+		free(d->batch->part_rows);
+		free(d->batch);
+		d->batch = NULL;
+	}
+
+	arena_free(&d->arena);
+	d->row_buff = NULL;
+	d->row_capacity = 0;
+	free(d->view);
+	free(d->field_lengths);
+	d->view = NULL;
+	d->field_lengths = NULL;
+	d->field_slots = 0;
+}
+
+//bytes formatted for all the partitions of o so far
+static size_t batch_bytes(struct output_file *o)
+{
+	size_t bytes = 0;
+	size_t ndx;
+
+	for(ndx = 0; ndx < o->num_parts; ++ndx)
+	{
+		bytes += o->parts[ndx].flushed + o->parts[ndx].len;
+	}
+
+	return bytes;
+}
+
+//fill b->selected with the rows passing every --where test of o and
+//return how many there are; fields are compared as parsed, quotes removed
+static size_t batch_select(struct output_file *o, struct row_batch *b)
+{
+	const struct where_clause* w = o->where;
+	const struct where_clause* stop = o->where + o->num_where;
+	uint32_t* sel = b->selected;
+	const char* const* start;
+	const size_t* len;
+	size_t count = b->num_rows;
+	size_t kept;
+	size_t ndx;
+	uint32_t row;
+	int want;
+
+	for(ndx = 0; ndx < count; ++ndx)
+	{
+		sel[ndx] = ndx;
+	}
+
+	for(; w < stop && count > 0; ++w)
+	{
+		start = b->start + w->column * b->capacity;
+		len = b->len + w->column * b->capacity;
+		want = (w->test == WHERE_EQ || w->test == WHERE_PREFIX);
+		kept = 0;
+		if(w->test == WHERE_EQ || w->test == WHERE_NE)
+		{
+			for(ndx = 0; ndx < count; ++ndx)
+			{
+				row = sel[ndx];
+				sel[kept] = row;
+				kept += ((len[row] == w->len && memcmp(start[row], w->value, w->len) == 0) == want);
+			}
+		}
+		else
+		{
+			for(ndx = 0; ndx < count; ++ndx)
+			{
+				row = sel[ndx];
+				sel[kept] = row;
+				kept += ((len[row] >= w->len && memcmp(start[row], w->value, w->len) == 0) == want);
+			}
+		}
+		count = kept;
+	}
+
+	return count;
+}
+
+//true if row of b passes every --where test of o (batch_select() for one row)
+static int row_selected(struct output_file *o, struct row_batch *b, uint32_t row)
+{
+	const struct where_clause* w;
+	const char* start;
+	size_t len;
+	int match;
+
+	for(w = o->where; w < o->where + o->num_where; ++w)
+	{
+		start = b->start[w->column * b->capacity + row];
+		len = b->len[w->column * b->capacity + row];
+		if(w->test == WHERE_EQ || w->test == WHERE_NE)
+		{
+			match = (len == w->len && memcmp(start, w->value, w->len) == 0);
+		}
+		else
+		{
+			match = (len >= w->len && memcmp(start, w->value, w->len) == 0);
+		}
+		if(match != (w->test == WHERE_EQ || w->test == WHERE_PREFIX))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//sort the count selected rows into b->sorted by partition, keeping their
+//order within each; partition p's rows end at b->part_rows[p].  A row's
+//partition is FNV-1a of its --partition-by fields.
+static void batch_partition(struct output_file *o, struct row_batch *b, size_t count)
+{
+	const unsigned char* p;
+	const unsigned char* stop;
+	uint64_t hash;
+	size_t column;
+	size_t ndx;
+	size_t sum;
+	uint32_t row;
+
+	for(ndx = 0; ndx < count; ++ndx)
+	{
+		row = b->selected[ndx];
+		hash = 14695981039346656037ULL;
+		for(column = 0; column < o->num_part_columns; ++column)
+		{
+			p = (const unsigned char*)b->start[o->part_columns[column] * b->capacity + row];
+			stop = p + b->len[o->part_columns[column] * b->capacity + row];
+			for(; p < stop; ++p)
+			{
+				hash = (hash ^ *p) * 1099511628211ULL;
+			}
+
+			//keeps "a","bc" and "ab","c" apart
+			hash = (hash ^ 0xff) * 1099511628211ULL;
+		}
+		b->part[ndx] = hash % o->num_parts;
+	}
+
+	//counting sort
+	memset(b->part_rows, 0, (o->num_parts + 1) * sizeof(size_t));
+	for(ndx = 0; ndx < count; ++ndx)
+	{
+		b->part_rows[b->part[ndx] + 1]++;
+	}
+	for(ndx = 0, sum = 0; ndx <= o->num_parts; ++ndx)
+	{
+		sum += b->part_rows[ndx];
+		b->part_rows[ndx] = sum;
+	}
+	for(ndx = 0; ndx < count; ++ndx)
+	{
+		b->sorted[b->part_rows[b->part[ndx]]++] = b->selected[ndx];
+	}
+}
+
+//-a: every column in input order
+static void emit_all(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n)
+{
+	const char* const* start;
+	const size_t* len;
+	size_t ndx;
+	size_t column;
+
+	for(ndx = 0; ndx < n; ++ndx)
+	{
+		start = b->start + rows[ndx];
+		len = b->len + rows[ndx];
+		out_field(o, *start, *len);
+		for(column = 1; column < b->width; ++column)
+		{
+			start += b->capacity;
+			len += b->capacity;
+			out_char(o, o->outdelim);
+			out_field(o, *start, *len);
+		}
+		out_char(o, '\n');
+	}
+}
+
+//-r: every column, last one first
+static void emit_reverse(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n)
+{
+	const char* const* start;
+	const size_t* len;
+	size_t ndx;
+	size_t column;
+
+	for(ndx = 0; ndx < n; ++ndx)
+	{
+		column = b->width - 1;
+		start = b->start + column * b->capacity + rows[ndx];
+		len = b->len + column * b->capacity + rows[ndx];
+		out_field(o, *start, *len);
+		while(column-- > 0)
+		{
+			start -= b->capacity;
+			len -= b->capacity;
+			out_char(o, o->outdelim);
+			out_field(o, *start, *len);
+		}
+		out_char(o, '\n');
+	}
+}
+
+//keys naming consecutive columns in increasing order
+static void emit_range(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n)
+{
+	const char* const* first_start = b->start + o->columns[0] * b->capacity;
+	const size_t* first_len = b->len + o->columns[0] * b->capacity;
+	const char* const* start;
+	const size_t* len;
+	size_t ndx;
+	size_t column;
+
+	for(ndx = 0; ndx < n; ++ndx)
+	{
+		start = first_start + rows[ndx];
+		len = first_len + rows[ndx];
+		out_field(o, *start, *len);
+		for(column = 1; column < o->num_columns; ++column)
+		{
+			start += b->capacity;
+			len += b->capacity;
+			out_char(o, o->outdelim);
+			out_field(o, *start, *len);
+		}
+		out_char(o, '\n');
+	}
+}
+
+//--format=csv|lenprefix|columnar: how the last output writes its rows
+static void formatAssign(struct data *d, char *optarg)
+{
+	if(d->outputs == NULL)
+	{
+		fileAssign(d, "");
+	}
+
+	if(strcmp(optarg, "csv") == 0)
+	{
+		d->last->format = FORMAT_CSV;
+	}
+	else if(strcmp(optarg, "lenprefix") == 0)
+	{
+		d->last->format = FORMAT_LENPREFIX;
+	}
+	else if(strcmp(optarg, "columnar") == 0)
+	{
+		d->last->format = FORMAT_COLUMNAR;
+	}
+	else
+	{
+		fail(d->failure, ERR_CODE_OPT, "invalid value %s for --format.", optarg);
+	}
+}
+
+//the column a binary output writes as its field number field: -a's and
+//-r's cover the first row's width, the keys' are those of the output
+static size_t output_column(struct output_file *o, struct row_batch *b, size_t field)
+{
+	if(o->all)
+	{
+		return field;
+	}
+	return o->rev ? b->width - 1 - field : o->columns[field];
+}
+
+//value as the four little-endian bytes at p
+static void put_u32(char *p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+//value as the eight little-endian bytes at p
+static void put_u64(char *p, uint64_t value)
+{
+	put_u32(p, value);
+	put_u32(p + 4, value >> 32);
+}
+
+//--format=lenprefix: each row is its field count and then every field's
+//length and bytes, straight from the batch
+static void emit_lenprefix(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n)
+{
+	struct out_buffer* sink = o->sink;
+	size_t fields = (o->all || o->rev) ? b->width : o->num_columns;
+	size_t ndx;
+	size_t field;
+	size_t cell;
+	size_t size;
+	char* dest;
+
+	for(ndx = 0; ndx < n; ++ndx)
+	{
+		size = (fields + 1) * sizeof(uint32_t);
+		for(field = 0; field < fields; ++field)
+		{
+			size += b->len[output_column(o, b, field) * b->capacity + rows[ndx]];
+		}
+
+		out_reserve(sink, size);
+		dest = sink->buff + sink->len;
+		put_u32(dest, fields);
+		dest += sizeof(uint32_t);
+		for(field = 0; field < fields; ++field)
+		{
+			cell = output_column(o, b, field) * b->capacity + rows[ndx];
+			put_u32(dest, b->len[cell]);
+			memcpy(dest + sizeof(uint32_t), b->start[cell], b->len[cell]);
+			dest += sizeof(uint32_t) + b->len[cell];
+		}
+		sink->len = dest - sink->buff;
+	}
+}
+
+//--format=columnar: the rows are one chunk, written a column at a time,
+//which is how the batch holds them
+static void emit_columnar(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n)
+{
+	struct out_buffer* sink = o->sink;
+	size_t fields = (o->all || o->rev) ? b->width : o->num_columns;
+	size_t header = sizeof(uint64_t) + 2 * sizeof(uint32_t) + fields * sizeof(uint64_t);
+	size_t ndx;
+	size_t field;
+	size_t column;
+	size_t size;
+	char* chunk;
+	char* dest;
+
+	if(n == 0)
+	{
+		return;
+	}
+
+	size = header;
+	for(field = 0; field < fields; ++field)
+	{
+		column = output_column(o, b, field);
+		size += n * sizeof(uint32_t);
+		for(ndx = 0; ndx < n; ++ndx)
+		{
+			size += b->len[column * b->capacity + rows[ndx]];
+		}
+	}
+
+	out_reserve(sink, size);
+	chunk = sink->buff + sink->len;
+	put_u64(chunk, size - sizeof(uint64_t));
+	put_u32(chunk + sizeof(uint64_t), n);
+	put_u32(chunk + sizeof(uint64_t) + sizeof(uint32_t), fields);
+	dest = chunk + header;
+	for(field = 0; field < fields; ++field)
+	{
+		column = output_column(o, b, field);
+		for(ndx = 0; ndx < n; ++ndx, dest += sizeof(uint32_t))
+		{
+			put_u32(dest, b->len[column * b->capacity + rows[ndx]]);
+		}
+		for(ndx = 0; ndx < n; ++ndx)
+		{
+			memcpy(dest, b->start[column * b->capacity + rows[ndx]], b->len[column * b->capacity + rows[ndx]]);
+			dest += b->len[column * b->capacity + rows[ndx]];
+		}
+		put_u64(chunk + header - (fields - field) * sizeof(uint64_t), dest - (chunk + header));
+	}
+	sink->len = dest - sink->buff;
+}
+
+//any other list of keys
+static void emit_columns(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n)
+{
+	const size_t* stop = o->columns + o->num_columns;
+	const size_t* column;
+	size_t ndx;
+	size_t cell;
+
+	for(ndx = 0; ndx < n; ++ndx)
+	{
+		cell = o->columns[0] * b->capacity + rows[ndx];
+		out_field(o, b->start[cell], b->len[cell]);
+		for(column = o->columns + 1; column < stop; ++column)
+		{
+			cell = *column * b->capacity + rows[ndx];
+			out_char(o, o->outdelim);
+			out_field(o, b->start[cell], b->len[cell]);
+		}
+		out_char(o, '\n');
+	}
+}
+
+//--sort-by K[,K...]: columns the last output's rows are sorted by, in order
+static void sortAssign(struct data *d, char *optarg)
+{
+	char* column = optarg;
+	char* end;
+	long new_key;
+
+	if(d->outputs == NULL)
+	{
+		fileAssign(d, "");
+	}
+
+	do
+	{
+		new_key = strtol(column, &end, 10);
+		if(end == column || (*end != ',' && *end != '\0'))
+		{
+			fail(d->failure, ERR_CODE_OPT, "invalid value %s for --sort-by.", optarg);
+		}
+		if(new_key < 1)
+		{
+			fail(d->failure, ERR_CODE_KOR, "key value %li is too low", new_key);
+		}
+
+		d->last->num_sort_columns++;
+		d->last->sort_columns = realloc(d->last->sort_columns, d->last->num_sort_columns * sizeof(size_t));
+		if(d->last->sort_columns == NULL)
+		{
+			fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+		}
+		d->last->sort_columns[d->last->num_sort_columns - 1] = new_key - 1;
+		column = end + 1;
+	}
+	while(*end == ',');
+}
+
+//when every output is a plain -a (delimited text of every row and column,
+//not sorted, filtered or partitioned), and so only the dialect may change,
+//rows are transcoded as they are parsed instead of going through a batch
+static void plan_transcode(struct data *d)
+{
+	struct output_file* output;
+
+	d->transcode = (d->outputs != NULL);
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		if(output->emit != emit_all || output->num_where > 0 || output->num_parts > 0)
+		{
+			d->transcode = false;
+		}
+	}
+}
+
+//outputs still sharing a buffer once sorters and filters have taken their
+//rows (as outputs to stdout do) take turns a row at a time in batch_emit();
+//columnar outputs keep writing whole chunks
+static void plan_interleave(struct data *d)
+{
+	struct output_file* output;
+	struct output_file* other;
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		for(other = d->outputs; other != NULL; other = other->next)
+		{
+			if(other != output && other->sink == output->sink && output->num_parts == 0 &&
+			   output->format != FORMAT_COLUMNAR)
+			{
+				output->interleave = true;
+			}
+		}
+	}
+}
+
+//give every --sort-by output a sorter, with an equal share of the budget,
+//and send its rows to the sorter as records
+static void plan_sort(struct data *d, size_t budget)
+{
+	struct output_file* output;
+	struct output_file* other;
+	struct sort_state* s;
+	size_t sorted = 0;
+	int ndx;
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		sorted += (output->num_sort_columns > 0);
+	}
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		if(output->num_sort_columns == 0)
+		{
+			continue;
+		}
+		if(output->num_parts > 0)
+		{
+			fail(d->failure, ERR_CODE_OPT, "--sort-by does not go with --partitions.");
+		}
+		if(output->format == FORMAT_COLUMNAR)
+		{
+			fail(d->failure, ERR_CODE_OPT, "--sort-by does not go with --format=columnar.");
+		}
+		for(other = d->outputs; other != NULL && (other == output || other->sink != output->sink); other = other->next);
+		if(other != NULL)
+		{
+			fail(d->failure, ERR_CODE_OPT, "%s is sorted, so it needs a file of its own.", output->name);
+		}
+
+		s = calloc(1, sizeof(struct sort_state));
+		if(s == NULL)
+		{
+			fail(d->failure, ERR_CODE_MEM, "unable to allocate sort buffers.");
+		}
+		output->sort = s;
+		s->failure = d->failure;
+		s->budget = budget / sorted / 2;
+		if(s->budget < OUTBUF_SIZE)
+		{
+			s->budget = OUTBUF_SIZE;
+		}
+		s->format = (output->format == FORMAT_LENPREFIX) ? emit_lenprefix :
+					(output->rev && !output->all) ? emit_reverse : emit_all;
+		for(ndx = 0; ndx < 2; ++ndx)
+		{
+			s->runs[ndx].num_keys = output->num_sort_columns;
+		}
+
+		s->dest = output->sink;
+		sink_init(&s->records, -1, CODEC_NONE, d->failure);
+		s->records.write = sort_write;
+		s->records.ctx = s;
+		output->sink = &s->records;
+		output->emit = emit_records;
+	}
+}
+
+//the column of a row's field number field in its record; SIZE_MAX for a
+//sort column past the end of the batch (an empty field)
+static size_t record_column(struct output_file *o, struct row_batch *b, size_t field)
+{
+	size_t column;
+
+	if(field < o->num_sort_columns)
+	{
+		column = o->sort_columns[field];
+	}
+	else
+	{
+		field -= o->num_sort_columns;
+		column = (o->all || o->rev) ? field : o->columns[field];
+	}
+
+	return (column < b->num_columns) ? column : SIZE_MAX;
+}
+
+//--sort-by and --distinct: rows go to the sorter or filter as records of
+//their sort columns and the columns the output writes (every column for -a
+//and -r)
+static void emit_records(struct output_file *o, struct row_batch *b, const uint32_t *rows, size_t n)
+{
+	struct out_buffer* sink = o->sink;
+	size_t fields = o->num_sort_columns + ((o->all || o->rev) ? b->width : o->num_columns);
+	size_t ndx;
+	size_t field;
+	size_t column;
+	size_t size;
+	uint32_t word;
+	char* dest;
+
+	for(ndx = 0; ndx < n; ++ndx)
+	{
+		size = (fields + 1) * sizeof(uint32_t);
+		for(field = 0; field < fields; ++field)
+		{
+			column = record_column(o, b, field);
+			size += (column == SIZE_MAX) ? 0 : b->len[column * b->capacity + rows[ndx]];
+		}
+
+		out_reserve(sink, size + sizeof(uint32_t));
+		dest = sink->buff + sink->len;
+		word = size;
+		memcpy(dest, &word, sizeof(uint32_t));
+		word = fields;
+		memcpy(dest + sizeof(uint32_t), &word, sizeof(uint32_t));
+		dest += 2 * sizeof(uint32_t);
+		for(field = 0; field < fields; ++field, dest += sizeof(uint32_t))
+		{
+			column = record_column(o, b, field);
+			word = (column == SIZE_MAX) ? 0 : b->len[column * b->capacity + rows[ndx]];
+			memcpy(dest, &word, sizeof(uint32_t));
+		}
+		for(field = 0; field < fields; ++field)
+		{
+			column = record_column(o, b, field);
+			if(column != SIZE_MAX && b->len[column * b->capacity + rows[ndx]] > 0)
+			{
+				memcpy(dest, b->start[column * b->capacity + rows[ndx]], b->len[column * b->capacity + rows[ndx]]);
+				dest += b->len[column * b->capacity + rows[ndx]];
+			}
+		}
+		sink->len = dest - sink->buff;
+	}
+}
+
+//make row (of capacity 1, with room for columns fields) the fields of
+//record after its num_keys sort columns
+static void record_row(struct row_batch *row, size_t *columns, const char *record, size_t num_keys, struct failure *f)
+{
+	const char* data;
+	uint32_t fields;
+	uint32_t len;
+	size_t ndx;
+
+	memcpy(&fields, record + sizeof(uint32_t), sizeof(uint32_t));
+	row->num_columns = fields - num_keys;
+	row->width = row->num_columns;
+	if(row->num_columns > *columns || row->start == NULL)
+	{
+		*columns = (row->num_columns > *columns) ? row->num_columns : *columns;
+		row->start = realloc(row->start, *columns * sizeof(char*));
+		row->len = realloc(row->len, *columns * sizeof(size_t));
+		if(row->start == NULL || row->len == NULL)
+		{
+			fail(f, ERR_CODE_MEM, "unable to allocate record buffers.");
+		}
+	}
+	row->capacity = 1;
+
+	data = record + (fields + 2) * sizeof(uint32_t);
+	for(ndx = 0; ndx < fields; ++ndx)
+	{
+		memcpy(&len, record + (ndx + 2) * sizeof(uint32_t), sizeof(uint32_t));
+		if(ndx >= num_keys)
+		{
+			row->start[ndx - num_keys] = data;
+			row->len[ndx - num_keys] = len;
+		}
+		data += len;
+	}
+	if(row->num_columns == 0)
+	{
+		row->start[0] = "";
+		row->len[0] = 0;
+	}
+}
+
+//the write callback of a sorter's sink: add the records to the run that is
+//filling, and spill the run once it holds its share of the budget
+static int sort_write(void *ctx, const char *buff, size_t len)
+{
+	struct sort_state* s = ctx;
+	struct sort_run* run = &s->runs[s->filling];
+	uint32_t size;
+
+	sort_grow(run, len, s->budget, s->failure);
+	memcpy(run->buff + run->len, buff, len);
+	run->len += len;
+
+	//records may be cut off where the sink was flushed
+	while(run->len - s->scanned >= sizeof(uint32_t))
+	{
+		memcpy(&size, run->buff + s->scanned, sizeof(uint32_t));
+		if(run->len - s->scanned < sizeof(uint32_t) + size)
+		{
+			break;
+		}
+		if(run->num_records == run->records_capacity)
+		{
+			run->records_capacity = run->records_capacity ? 2 * run->records_capacity : 4096;
+			run->records = realloc(run->records, run->records_capacity * sizeof(size_t));
+			if(run->records == NULL)
+			{
+				fail(s->failure, ERR_CODE_MEM, "unable to allocate sort buffers.");
+			}
+		}
+		run->records[run->num_records++] = s->scanned;
+		s->scanned += sizeof(uint32_t) + size;
+	}
+
+	if(run->len + run->num_records * sizeof(size_t) >= s->budget)
+	{
+		sort_spill(s);
+	}
+
+	return 0;
+}
+
+//make room for n more bytes in run, growing it no further than limit
+//unless a single record needs more
+static void sort_grow(struct sort_run *run, size_t n, size_t limit, struct failure *f)
+{
+	size_t capacity;
+
+	if(run->len + n <= run->capacity)
+	{
+		return;
+	}
+
+	capacity = run->capacity ? 2 * run->capacity : OUTBUF_SIZE;
+	if(capacity > limit)
+	{
+		capacity = limit;
+	}
+	if(capacity < run->len + n)
+	{
+		capacity = run->len + n;
+	}
+	run->buff = realloc(run->buff, capacity);
+	if(run->buff == NULL)
+	{
+		fail(f, ERR_CODE_MEM, "unable to allocate sort buffers.");
+	}
+	run->capacity = capacity;
+}
+
+//hand the whole records of the filling run to a thread that sorts them and
+//writes them out, and fill the other run meanwhile
+static void sort_spill(struct sort_state *s)
+{
+	struct sort_run* run = &s->runs[s->filling];
+	struct sort_run* next = &s->runs[1 - s->filling];
+	FILE** spills;
+
+	//the other run is free once the last spill is done
+	sort_join(s);
+
+	//a record cut off at the end moves to the other run
+	next->len = 0;
+	next->num_records = 0;
+	sort_grow(next, run->len - s->scanned, s->budget, s->failure);
+	memcpy(next->buff, run->buff + s->scanned, run->len - s->scanned);
+	next->len = run->len - s->scanned;
+	run->len = s->scanned;
+	s->scanned = 0;
+
+	spills = realloc(s->spills, (s->num_spills + 1) * sizeof(FILE*));
+	if(spills == NULL)
+	{
+		fail(s->failure, ERR_CODE_MEM, "unable to allocate sort buffers.");
+	}
+	s->spills = spills;
+	s->spills[s->num_spills++] = NULL;
+
+	s->filling = 1 - s->filling;
+	if(pthread_create(&s->spiller, NULL, thread_sort_spill, s) != 0)
+	{
+		fail(s->failure, ERR_CODE_PTH, "unable to create a thread: %s.", strerror(errno));
+	}
+	s->spilling = true;
+}
+
+//wait for the spiller, if it is running, and report its error
+static void sort_join(struct sort_state *s)
+{
+	if(s->spilling)
+	{
+		pthread_join(s->spiller, NULL);
+		s->spilling = false;
+	}
+	if(s->error != ERR_CODE_AOK)
+	{
+		fail(s->failure, s->error, "%s", s->message);
+	}
+}
+
+//sort the run that is not filling and write it to a temporary file
+static void* thread_sort_spill(void* data_ptr)
+{
+	struct sort_state* s = (struct sort_state*)data_ptr;
+	struct sort_run* run = &s->runs[1 - s->filling];
+	FILE* file;
+	uint32_t size;
+	size_t ndx;
+
+	sort_records(run);
+
+	file = sort_tempfile();
+	if(file == NULL)
+	{
+		s->error = ERR_CODE_FIL;
+		snprintf(s->message, sizeof(s->message), "unable to create a sort file: %s.", strerror(errno));
+		failure_record(s->failure, s->error, s->message);
+		return NULL;
+	}
+	for(ndx = 0; ndx < run->num_records; ++ndx)
+	{
+		memcpy(&size, run->buff + run->records[ndx], sizeof(uint32_t));
+		fwrite(run->buff + run->records[ndx], sizeof(uint32_t) + size, 1, file);
+	}
+	if(fflush(file) != 0 || ferror(file))
+	{
+		s->error = ERR_CODE_FIL;
+		snprintf(s->message, sizeof(s->message), "failed writing a sort file: %s.", strerror(errno));
+		failure_record(s->failure, s->error, s->message);
+		fclose(file);
+		return NULL;
+	}
+	rewind(file);
+	s->spills[s->num_spills - 1] = file;
+
+	return NULL;
+}
+
+//put the records of run in order; equal keys keep the input order
+static void sort_records(struct sort_run *run)
+{
+	qsort_r(run->records, run->num_records, sizeof(size_t), sort_compare, run);
+}
+
+static int sort_compare(const void *a, const void *b, void *ctx)
+{
+	struct sort_run* run = ctx;
+	size_t left = *(const size_t*)a;
+	size_t right = *(const size_t*)b;
+	int order = record_compare(run->buff + left, run->buff + right, run->num_keys);
+
+	if(order != 0)
+	{
+		return order;
+	}
+	return (left < right) ? -1 : (left > right);
+}
+
+//compare the sort columns of two records byte by byte, a shorter field
+//first where one is the start of the other
+static int record_compare(const char *a, const char *b, size_t num_keys)
+{
+	uint32_t fields_a;
+	uint32_t fields_b;
+	uint32_t len_a;
+	uint32_t len_b;
+	const char* data_a;
+	const char* data_b;
+	size_t ndx;
+	int order;
+
+	memcpy(&fields_a, a + sizeof(uint32_t), sizeof(uint32_t));
+	memcpy(&fields_b, b + sizeof(uint32_t), sizeof(uint32_t));
+	data_a = a + (fields_a + 2) * sizeof(uint32_t);
+	data_b = b + (fields_b + 2) * sizeof(uint32_t);
+	for(ndx = 0; ndx < num_keys; ++ndx)
+	{
+		memcpy(&len_a, a + (ndx + 2) * sizeof(uint32_t), sizeof(uint32_t));
+		memcpy(&len_b, b + (ndx + 2) * sizeof(uint32_t), sizeof(uint32_t));
+		order = memcmp(data_a, data_b, (len_a < len_b) ? len_a : len_b);
+		if(order != 0)
+		{
+			return order;
+		}
+		if(len_a != len_b)
+		{
+			return (len_a < len_b) ? -1 : 1;
+		}
+		data_a += len_a;
+		data_b += len_b;
+	}
+
+	return 0;
+}
+
+//an unnamed file in $TMPDIR (or /tmp), gone once it is closed
+static FILE* sort_tempfile(void)
+{
+	const char* dir = getenv("TMPDIR");
+	char path[4096];
+	FILE* file;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/csvreo-sort-XXXXXX", (dir != NULL && *dir != '\0') ? dir : "/tmp");
+	fd = mkstemp(path);
+	if(fd < 0)
+	{
+		return NULL;
+	}
+	unlink(path);
+
+	file = fdopen(fd, "w+");
+	if(file == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+	setvbuf(file, NULL, _IOFBF, 1 << 18);
+
+	return file;
+}
+
+//the next record of a spilled run, read into buff; NULL at its end
+static const char* sort_read(FILE *file, char **buff, size_t *capacity)
+{
+	uint32_t size;
+
+	if(fread(&size, sizeof(uint32_t), 1, file) != 1)
+	{
+		return NULL;
+	}
+	if(sizeof(uint32_t) + size > *capacity)
+	{
+		*capacity = sizeof(uint32_t) + size;
+		*buff = realloc(*buff, *capacity);
+		if(*buff == NULL)
+		{
+			return NULL;
+		}
+	}
+	memcpy(*buff, &size, sizeof(uint32_t));
+	if(fread(*buff + sizeof(uint32_t), size, 1, file) != 1 && size > 0)
+	{
+		return NULL;
+	}
+
+	return *buff;
+}
+
+//whether merge source a's record is written before source b's; sources
+//are numbered in input order, so equal keys keep it
+static int merge_before(const char **current, size_t a, size_t b, size_t num_keys)
+{
+	int order = record_compare(current[a], current[b], num_keys);
+
+	return order < 0 || (order == 0 && a < b);
+}
+
+//the input has ended: sort the records held, merge them with the spilled
+//runs and write the rows to the output's own sink
+static void sort_finish(struct output_file *o, int stats)
+{
+	struct sort_state* s = o->sort;
+	struct sort_run* run;
+	struct output_file flat = *o;
+	struct row_batch row;
+	const char** current;
+	char** buffs;
+	size_t* capacity;
+	size_t* heap;
+	size_t num_sources;
+	size_t num_heap;
+	size_t next = 0;
+	size_t columns = 1;
+	size_t written = s->dest->flushed + s->dest->len;
+	uint32_t zero = 0;
+	size_t ndx;
+	size_t child;
+	size_t top;
+	double start;
+
+	//the last records reach sort_write() here
+	queue_finish(&s->records);
+	sort_join(s);
+	start = stats ? now() : 0;
+	run = &s->runs[s->filling];
+	sort_records(run);
+
+	//one source per spilled run, and the run in memory last, so that equal
+	//keys keep the input order
+	num_sources = s->num_spills + 1;
+	current = calloc(num_sources, sizeof(char*));
+	buffs = calloc(num_sources, sizeof(char*));
+	capacity = calloc(num_sources, sizeof(size_t));
+	heap = malloc(num_sources * sizeof(size_t));
+	row.start = malloc(columns * sizeof(char*));
+	row.len = malloc(columns * sizeof(size_t));
+	if(current == NULL || buffs == NULL || capacity == NULL || heap == NULL || row.start == NULL || row.len == NULL)
+	{
+		fail(s->failure, ERR_CODE_MEM, "unable to allocate sort buffers.");
+	}
+	row.capacity = 1;
+
+	//a binary heap of the sources by their current record
+	num_heap = 0;
+	for(ndx = 0; ndx < num_sources; ++ndx)
+	{
+		if(ndx < s->num_spills)
+		{
+			current[ndx] = sort_read(s->spills[ndx], &buffs[ndx], &capacity[ndx]);
+		}
+		else if(next < run->num_records)
+		{
+			current[ndx] = run->buff + run->records[next++];
+		}
+		if(current[ndx] == NULL)
+		{
+			continue;
+		}
+		for(child = num_heap++; child > 0 && merge_before(current, ndx, heap[(child - 1) / 2], run->num_keys); child = (child - 1) / 2)
+		{
+			heap[child] = heap[(child - 1) / 2];
+		}
+		heap[child] = ndx;
+	}
+
+	flat.sink = s->dest;
+	flat.all = (o->all || !o->rev);
+	while(num_heap > 0)
+	{
+		//write the smallest record as a row of the output's columns
+		top = heap[0];
+		record_row(&row, &columns, current[top], run->num_keys, s->failure);
+		s->format(&flat, &row, &zero, 1);
+
+		//the next record of that source takes its place
+		if(top < s->num_spills)
+		{
+			current[top] = sort_read(s->spills[top], &buffs[top], &capacity[top]);
+			if(current[top] == NULL && ferror(s->spills[top]))
+			{
+				fail(s->failure, ERR_CODE_FIL, "failed reading a sort file.");
+			}
+		}
+		else
+		{
+			current[top] = (next < run->num_records) ? run->buff + run->records[next++] : NULL;
+		}
+		if(current[top] == NULL)
+		{
+			top = heap[--num_heap];
+		}
+		for(ndx = 0; (child = 2 * ndx + 1) < num_heap; ndx = child)
+		{
+			if(child + 1 < num_heap && merge_before(current, heap[child + 1], heap[child], run->num_keys))
+			{
+				++child;
+			}
+			if(!merge_before(current, heap[child], top, run->num_keys))
+			{
+				break;
+			}
+			heap[ndx] = heap[child];
+		}
+		heap[ndx] = top;
+	}
+
+	for(ndx = 0; ndx < num_sources; ++ndx)
+	{
+		free(buffs[ndx]);
+	}
+	free(current);
+	free(buffs);
+	free(capacity);
+	free(heap);
+	free(row.start);
+	free(row.len);
+
+	//the output writes its rows, not the records, from here on
+	o->sink = s->dest;
+	queue_finish(o->sink);
+	if(stats)
+	{
+		o->emit_time += now() - start;
+		o->bytes = s->dest->flushed + s->dest->len - written;
+	}
+}
+
+//free o's sorter, stopping its spiller if the job failed
+static void sort_free(struct output_file *o)
+{
+	struct sort_state* s = o->sort;
+	size_t ndx;
+
+	if(s->spilling)
+	{
+		pthread_join(s->spiller, NULL);
+	}
+	for(ndx = 0; ndx < s->num_spills; ++ndx)
+	{
+		if(s->spills[ndx] != NULL)
+		{
+			fclose(s->spills[ndx]);
+		}
+	}
+	free(s->spills);
+	for(ndx = 0; ndx < 2; ++ndx)
+	{
+		free(s->runs[ndx].buff);
+		free(s->runs[ndx].records);
+	}
+	free(s->records.buff);
+	o->sink = s->dest;
+	free(s);
+	o->sort = NULL;
+}
+
+//give every --distinct output a filter, with an equal share of the budget,
+//and send its rows to the filter as records; a sorted output's filter hands
+//the first occurrences on to its sorter
+static void plan_distinct(struct data *d, size_t budget)
+{
+	struct output_file* output;
+	struct output_file* other;
+	struct distinct_state* s;
+	size_t filtered = 0;
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		filtered += output->distinct;
+	}
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		if(!output->distinct)
+		{
+			continue;
+		}
+		if(output->num_parts > 0)
+		{
+			fail(d->failure, ERR_CODE_OPT, "--distinct does not go with --partitions.");
+		}
+		if(output->format == FORMAT_COLUMNAR)
+		{
+			fail(d->failure, ERR_CODE_OPT, "--distinct does not go with --format=columnar.");
+		}
+		for(other = d->outputs; other != NULL && (other == output || other->sink != output->sink); other = other->next);
+		if(other != NULL)
+		{
+			fail(d->failure, ERR_CODE_OPT, "%s is --distinct, so it needs a file of its own.", output->name);
+		}
+
+		s = calloc(1, sizeof(struct distinct_state));
+		if(s == NULL)
+		{
+			fail(d->failure, ERR_CODE_MEM, "unable to allocate distinct buffers.");
+		}
+		output->dedup = s;
+		s->failure = d->failure;
+		for(s->max_slots = DISTINCT_SLOTS;
+			4 * s->max_slots * sizeof(uint64_t) <= budget / filtered;
+			s->max_slots *= 2);
+		distinct_grow(s, DISTINCT_SLOTS);
+		s->num_keys = output->num_sort_columns;
+		s->format = (output->format == FORMAT_LENPREFIX) ? emit_lenprefix :
+					(output->rev && !output->all) ? emit_reverse : emit_all;
+		s->row_columns = 1;
+
+		s->dest = output->sink;
+		s->sorted = (output->sort != NULL);
+		sink_init(&s->records, -1, CODEC_NONE, d->failure);
+		s->records.write = distinct_write;
+		s->records.ctx = s;
+		output->sink = &s->records;
+		output->emit = emit_records;
+		s->flat = *output;
+		s->flat.sink = s->dest;
+		s->flat.all = (output->all || !output->rev);
+	}
+}
+
+//the write callback of a filter's sink: check the records in order
+static int distinct_write(void *ctx, const char *buff, size_t len)
+{
+	struct distinct_state* s = ctx;
+	const char* end = buff + len;
+	int carried = false;
+	uint32_t size;
+
+	//records may be cut off where the sink was flushed
+	if(s->carry_len > 0)
+	{
+		distinct_carry(s, buff, len);
+		buff = s->carry;
+		end = s->carry + s->carry_len;
+		carried = true;
+	}
+
+	while((size_t)(end - buff) >= sizeof(uint32_t))
+	{
+		memcpy(&size, buff, sizeof(uint32_t));
+		if((size_t)(end - buff) < sizeof(uint32_t) + size)
+		{
+			break;
+		}
+		distinct_record(s, buff, 0);
+		buff += sizeof(uint32_t) + size;
+	}
+
+	if(carried)
+	{
+		memmove(s->carry, buff, end - buff);
+		s->carry_len = end - buff;
+	}
+	else if(buff < end)
+	{
+		distinct_carry(s, buff, end - buff);
+	}
+
+	return 0;
+}
+
+//add len bytes to the end of the filter's carry
+static void distinct_carry(struct distinct_state *s, const char *buff, size_t len)
+{
+	if(s->carry_len + len > s->carry_capacity)
+	{
+		s->carry_capacity = s->carry_len + len;
+		s->carry = realloc(s->carry, s->carry_capacity);
+		if(s->carry == NULL)
+		{
+			fail(s->failure, ERR_CODE_MEM, "unable to allocate distinct buffers.");
+		}
+	}
+	memcpy(s->carry + s->carry_len, buff, len);
+	s->carry_len += len;
+}
+
+//pass record on if the set has not seen it; with the set full, records it
+//does not hold go to the spill files of level
+static void distinct_record(struct distinct_state *s, const char *record, size_t level)
+{
+	FILE** file;
+	uint64_t h[2];
+	uint32_t size;
+	int added;
+
+	record_fingerprint(record, s->num_keys, h);
+	added = distinct_add(s, h);
+	if(added > 0)
+	{
+		distinct_emit(s, record);
+	}
+	else if(added < 0)
+	{
+		if(level == DISTINCT_LEVELS)
+		{
+			fail(s->failure, ERR_CODE_MEM, "--distinct-mem is too small for the distinct rows.");
+		}
+
+		file = &s->spills[level][(h[1] >> (6 * level)) % DISTINCT_FANOUT];
+		if(*file == NULL && (*file = sort_tempfile()) == NULL)
+		{
+			fail(s->failure, ERR_CODE_FIL, "unable to create a distinct file: %s.", strerror(errno));
+		}
+		memcpy(&size, record, sizeof(uint32_t));
+		if(fwrite(record, sizeof(uint32_t) + size, 1, *file) != 1)
+		{
+			fail(s->failure, ERR_CODE_FIL, "failed writing a distinct file.");
+		}
+	}
+}
+
+//128-bit fingerprint of the fields of record after its num_keys sort
+//columns: their lengths, then their bytes
+static void record_fingerprint(const char *record, size_t num_keys, uint64_t *h)
+{
+	const char* data;
+	uint32_t size;
+	uint32_t fields;
+	uint32_t len;
+	size_t ndx;
+
+	memcpy(&size, record, sizeof(uint32_t));
+	memcpy(&fields, record + sizeof(uint32_t), sizeof(uint32_t));
+	data = record + (fields + 2) * sizeof(uint32_t);
+	for(ndx = 0; ndx < num_keys; ++ndx)
+	{
+		memcpy(&len, record + (ndx + 2) * sizeof(uint32_t), sizeof(uint32_t));
+		data += len;
+	}
+
+	h[0] = 0x243f6a8885a308d3ULL;
+	h[1] = 0x13198a2e03707344ULL;
+	fingerprint_mix(h, record + (num_keys + 2) * sizeof(uint32_t), (fields - num_keys) * sizeof(uint32_t));
+	fingerprint_mix(h, data, record + sizeof(uint32_t) + size - data);
+
+	//murmur3's finalizer on each word, so every bit of the input moves
+	//every bit of both
+	h[0] ^= h[0] >> 33;
+	h[0] *= 0xff51afd7ed558ccdULL;
+	h[0] ^= h[0] >> 33;
+	h[0] *= 0xc4ceb9fe1a85ec53ULL;
+	h[0] ^= h[0] >> 33;
+	h[1] ^= h[0];
+	h[1] ^= h[1] >> 33;
+	h[1] *= 0xff51afd7ed558ccdULL;
+	h[1] ^= h[1] >> 33;
+	h[1] *= 0xc4ceb9fe1a85ec53ULL;
+	h[1] ^= h[1] >> 33;
+
+	//0, 0 marks an empty slot
+	if(h[0] == 0 && h[1] == 0)
+	{
+		h[0] = 1;
+	}
+}
+
+//mix len bytes into the two words of h, eight at a time; the last word
+//holds the bytes left over and their count
+static void fingerprint_mix(uint64_t *h, const char *p, size_t len)
+{
+	uint64_t word;
+
+	for(; len >= sizeof(uint64_t); p += sizeof(uint64_t), len -= sizeof(uint64_t))
+	{
+		memcpy(&word, p, sizeof(uint64_t));
+		h[0] = (h[0] ^ word) * 0x9e3779b97f4a7c15ULL;
+		h[0] = (h[0] << 29) | (h[0] >> 35);
+		h[1] = (h[1] + word) * 0xc2b2ae3d27d4eb4fULL;
+		h[1] = (h[1] << 31) | (h[1] >> 33);
+	}
+
+	word = 0;
+	memcpy(&word, p, len);
+	word ^= (uint64_t)len << 56;
+	h[0] = (h[0] ^ word) * 0x9e3779b97f4a7c15ULL;
+	h[0] = (h[0] << 29) | (h[0] >> 35);
+	h[1] = (h[1] + word) * 0xc2b2ae3d27d4eb4fULL;
+	h[1] = (h[1] << 31) | (h[1] >> 33);
+}
+
+//add fingerprint h to the set: 1 if it is new, 0 if it was there already
+//and -1 if it is new but the set is full
+static int distinct_add(struct distinct_state *s, const uint64_t *h)
+{
+	size_t mask = s->capacity - 1;
+	size_t slot;
+	uint64_t* seen;
+
+	for(slot = h[0] & mask; ; slot = (slot + 1) & mask)
+	{
+		seen = s->seen + 2 * slot;
+		if(seen[0] == h[0] && seen[1] == h[1])
+		{
+			return 0;
+		}
+		if(seen[0] == 0 && seen[1] == 0)
+		{
+			break;
+		}
+	}
+
+	//the set is kept at most three quarters full, so probes stay short
+	if(4 * (s->count + 1) > 3 * s->capacity)
+	{
+		if(s->capacity >= s->max_slots)
+		{
+			return -1;
+		}
+		distinct_grow(s, 2 * s->capacity);
+		return distinct_add(s, h);
+	}
+
+	seen[0] = h[0];
+	seen[1] = h[1];
+	s->count++;
+	return 1;
+}
+
+//move the set to capacity slots (a power of 2); an empty set is just
+//allocated
+static void distinct_grow(struct distinct_state *s, size_t capacity)
+{
+	uint64_t* old = s->seen;
+	size_t old_capacity = s->capacity;
+	size_t ndx;
+	size_t slot;
+
+	s->seen = calloc(capacity, 2 * sizeof(uint64_t));
+	if(s->seen == NULL)
+	{
+		fail(s->failure, ERR_CODE_MEM, "unable to allocate distinct buffers.");
+	}
+	s->capacity = capacity;
+
+	for(ndx = 0; ndx < old_capacity && s->count > 0; ++ndx)
+	{
+		if(old[2 * ndx] == 0 && old[2 * ndx + 1] == 0)
+		{
+			continue;
+		}
+		for(slot = old[2 * ndx] & (capacity - 1); s->seen[2 * slot] != 0 || s->seen[2 * slot + 1] != 0; slot = (slot + 1) & (capacity - 1));
+		s->seen[2 * slot] = old[2 * ndx];
+		s->seen[2 * slot + 1] = old[2 * ndx + 1];
+	}
+	free(old);
+}
+
+//write a first occurrence to the output, or hand it to the sorter as is
+static void distinct_emit(struct distinct_state *s, const char *record)
+{
+	uint32_t size;
+	uint32_t zero = 0;
+
+	if(s->sorted)
+	{
+		memcpy(&size, record, sizeof(uint32_t));
+		out_reserve(s->dest, sizeof(uint32_t) + size);
+		memcpy(s->dest->buff + s->dest->len, record, sizeof(uint32_t) + size);
+		s->dest->len += sizeof(uint32_t) + size;
+	}
+	else
+	{
+		record_row(&s->row, &s->row_columns, record, s->num_keys, s->failure);
+		s->format(&s->flat, &s->row, &zero, 1);
+	}
+}
+
+//filter the spill files of level one at a time; they hold different
+//fingerprints, so each starts with an empty set, and what does not fit
+//that set is split into the files of the next level
+static void distinct_drain(struct distinct_state *s, size_t level)
+{
+	FILE** file;
+	const char* record;
+	size_t ndx;
+
+	for(ndx = 0; ndx < DISTINCT_FANOUT; ++ndx)
+	{
+		file = &s->spills[level][ndx];
+		if(*file == NULL)
+		{
+			continue;
+		}
+
+		rewind(*file);
+		free(s->seen);
+		s->seen = NULL;
+		s->capacity = 0;
+		s->count = 0;
+		distinct_grow(s, DISTINCT_SLOTS);
+		while((record = sort_read(*file, &s->buff, &s->buff_capacity)) != NULL)
+		{
+			distinct_record(s, record, level + 1);
+		}
+		if(ferror(*file))
+		{
+			fail(s->failure, ERR_CODE_FIL, "failed reading a distinct file.");
+		}
+		fclose(*file);
+		*file = NULL;
+
+		distinct_drain(s, level + 1);
+	}
+}
+
+//the input has ended: filter the records spilled and write what is left
+//of the output to its own sink (or its sorter)
+static void distinct_finish(struct output_file *o, int stats)
+{
+	struct distinct_state* s = o->dedup;
+	double start;
+
+	//the last records reach distinct_write() here
+	queue_finish(&s->records);
+	start = stats ? now() : 0;
+	distinct_drain(s, 0);
+
+	//the output writes its rows, or its records to the sorter, from here on
+	o->sink = s->dest;
+	if(!s->sorted)
+	{
+		queue_finish(o->sink);
+	}
+	if(stats)
+	{
+		o->emit_time += now() - start;
+		o->bytes = s->dest->flushed + s->dest->len;
+	}
+}
+
+//free o's filter and close its spill files
+static void distinct_free(struct output_file *o)
+{
+	struct distinct_state* s = o->dedup;
+	size_t level;
+	size_t ndx;
+
+	for(level = 0; level < DISTINCT_LEVELS; ++level)
+	{
+		for(ndx = 0; ndx < DISTINCT_FANOUT; ++ndx)
+		{
+			if(s->spills[level][ndx] != NULL)
+			{
+				fclose(s->spills[level][ndx]);
+			}
+		}
+	}
+	free(s->seen);
+	free(s->carry);
+	free(s->buff);
+	free(s->row.start);
+	free(s->row.len);
+	free(s->records.buff);
+	o->sink = s->dest;
+	free(s);
+	o->dedup = NULL;
+}
+
+//the sink an output's rows end up in, past its filter and sorter
+static struct out_buffer* output_sink(struct output_file *o)
+{
+	if(o->sort != NULL)
+	{
+		return o->sort->dest;
+	}
+	return (o->dedup != NULL) ? o->dedup->dest : o->sink;
+}
+
+//wall-clock seconds
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//print the --stats report to stderr
+static void stats_report(struct data *d, double wall, double cpu)
+{
+	struct stage_stats* s = &d->timing;
+	struct output_file* output;
+	size_t stalls;
+
+	if(d->stats == STATS_JSON)
+	{
+		fprintf(stderr, "{\"rows\":%zu,\"wall_s\":%.6f,\"cpu_s\":%.6f,", d->row, wall, cpu);
+		fprintf(stderr, "\"input\":{\"bytes\":%zu,\"read_s\":%.6f,\"ring_full_waits\":%zu},",
+				s->bytes_read, s->read_time, s->full_waits);
+		fprintf(stderr, "\"parse\":{\"seconds\":%.6f,\"ring_empty_waits\":%zu,"
+				"\"peak_arena\":%zu,\"peak_field_slots\":%zu,\"peak_carry\":%zu},",
+				s->parse_time, s->empty_waits, s->peak_arena, s->peak_fields, s->peak_carry);
+		fprintf(stderr, "\"outputs\":[");
+		for(output = d->outputs; output != NULL; output = output->next)
+		{
+			stalls = stats_stalls(output);
+			fprintf(stderr, "{\"file\":");
+			stats_string(output->name);
+			fprintf(stderr, ",\"bytes\":%zu,\"emit_s\":%.6f,\"queue_full_waits\":%zu}%s",
+					output->bytes, output->emit_time, stalls, output->next ? "," : "");
+		}
+		fprintf(stderr, "]}\n");
+		return;
+	}
+
+	fprintf(stderr, "Stats:\n");
+	fprintf(stderr, "  %zu rows in %.3f s wall, %.3f s cpu (%.1f MB/s, %.0f rows/s)\n",
+			d->row, wall, cpu, wall > 0 ? s->bytes_read / 1e6 / wall : 0,
+			wall > 0 ? d->row / wall : 0);
+	fprintf(stderr, "  input:  %zu bytes, %.3f s blocked reading, %zu waits for a free buffer\n",
+			s->bytes_read, s->read_time, s->full_waits);
+	fprintf(stderr, "  parse:  %.3f s (formatting included), %zu waits for input\n",
+			s->parse_time, s->empty_waits);
+	fprintf(stderr, "  peak:   %zu byte field arena, %zu field slots, %zu byte carry\n",
+			s->peak_arena, s->peak_fields, s->peak_carry);
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		stalls = stats_stalls(output);
+		fprintf(stderr, "  output %s: %zu bytes, %.3f s formatting, %zu waits for its writer\n",
+				output->name, output->bytes, output->emit_time, stalls);
+	}
+}
+
+//times rows waited for the writers of o; a partitioned output's are
+//summed over its parts
+static size_t stats_stalls(struct output_file *o)
+{
+	size_t stalls = 0;
+	size_t ndx;
+
+	if(o->num_parts == 0)
+	{
+		return o->sink->queue ? o->sink->queue->stalls : 0;
+	}
+	for(ndx = 0; ndx < o->num_parts; ++ndx)
+	{
+		stalls += o->parts[ndx].queue ? o->parts[ndx].queue->stalls : 0;
+	}
+
+	return stalls;
+}
+
+//a JSON string, for file names
+static void stats_string(const char *s)
+{
+	fputc('"', stderr);
+	for(; *s; ++s)
+	{
+		if(*s == '"' || *s == '\\')
+		{
+			fprintf(stderr, "\\%c", *s);
+		}
+		else if((unsigned char)*s < 0x20)
+		{
+			fprintf(stderr, "\\u%04x", *s);
+		}
+		else
+		{
+			fputc(*s, stderr);
+		}
+	}
+	fputc('"', stderr);
+}
+
+//seconds, with an optional s, m or h suffix
+static double intervalAssign(char *optarg, struct failure *f)
+{
+	char *end;
+	double value = strtod(optarg, &end);
+
+	switch(*end)
+	{
+		case 'h': value *= 3600; ++end; break;
+		case 'm': value *= 60; ++end; break;
+		case 's': ++end; break;
+	}
+
+	if(end == optarg || *end != '\0' || !(value > 0))
+	{
+		fail(f, ERR_CODE_OPT, "invalid value %s for --progress-interval.", optarg);
+	}
+
+	return value;
+}
+
+static void progress_start(struct progress_report *p, struct data *d, size_t total, double interval, size_t every)
+{
+	p->dat = d;
+	p->total = total;
+	p->interval = interval;
+	p->every = every;
+	p->next_rows = every;
+	p->start = now();
+	p->last_time = p->start;
+	p->last_rows = 0;
+	p->last_bytes = 0;
+	p->done = false;
+
+	if(pthread_create(&p->id, NULL, thread_progress, p) != 0)
+	{
+		fail(d->failure, ERR_CODE_PTH, "unable to create a thread: %s.", strerror(errno));
+	}
+}
+
+static void progress_finish(struct progress_report *p)
+{
+	__atomic_store_n(&p->done, true, __ATOMIC_RELAXED);
+	pthread_kill(p->id, SIGUSR1);
+	pthread_join(p->id, NULL);
+}
+
+//one progress line: rates since the last line, and percent done and time
+//left from the average rate when the input size is known
+static void progress_print(struct progress_report *p, const char *what)
+{
+	size_t rows = __atomic_load_n(&p->dat->row, __ATOMIC_RELAXED);
+	size_t bytes = __atomic_load_n(&p->dat->timing.bytes_read, __ATOMIC_RELAXED);
+	double time = now();
+	double span = (time > p->last_time) ? time - p->last_time : 1e-9;
+	double left;
+
+	fprintf(stderr, "%s%zi records processed, %.0f rows/s, %.1f MB/s",
+			what, rows, (rows - p->last_rows) / span, (bytes - p->last_bytes) / 1e6 / span);
+	if(p->total > 0 && bytes > 0)
+	{
+		left = (p->total - bytes) * (time - p->start) / bytes;
+		fprintf(stderr, ", %.1f%% read, ETA %d:%02d:%02d",
+				100.0 * bytes / p->total,
+				(int)(left / 3600), (int)(left / 60) % 60, (int)left % 60);
+	}
+	fprintf(stderr, "\n");
+
+	p->last_time = time;
+	p->last_rows = rows;
+	p->last_bytes = bytes;
+}
+
+static void* thread_progress(void* data_ptr)
+{
+	struct progress_report* p = (struct progress_report*)data_ptr;
+	struct timespec wait;
+	sigset_t usr1;
+	double next = p->start + p->interval;
+	double left;
+	size_t rows;
+
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+
+	for(;;)
+	{
+		//a message every so many rows needs the count looked at often
+		left = (p->every > 0) ? PROGRESS_POLL : next - now();
+		if(left < 0)
+		{
+			left = 0;
+		}
+		wait.tv_sec = (time_t)left;
+		wait.tv_nsec = (long)((left - wait.tv_sec) * 1e9);
+
+		if(sigtimedwait(&usr1, NULL, &wait) == SIGUSR1)
+		{
+			if(__atomic_load_n(&p->done, __ATOMIC_RELAXED))
+			{
+				break;
+			}
+			progress_print(p, "Snapshot: ");
+		}
+		else if(p->every > 0)
+		{
+			rows = __atomic_load_n(&p->dat->row, __ATOMIC_RELAXED);
+			if(rows >= p->next_rows)
+			{
+				progress_print(p, "");
+				p->next_rows = (rows / p->every + 1) * p->every;
+			}
+		}
+		else if(now() >= next)
+		{
+			progress_print(p, "");
+			next += p->interval;
+		}
+	}
+
+	return NULL;
+}
+
+static void check_opts(struct data *d)
+{
+	struct output_file* output = d->outputs;
+	if(isalnum(d->delim))
+	{
+		fail(d->failure, ERR_CODE_BDD, "%c is not a valid delimiter.", d->delim);
+	}
+
+	while(output != NULL)
+	{
+		if(isalnum(output->outdelim))
+		{
+			fail(d->failure, ERR_CODE_BDD, "%c is not a valid delimiter.", output->outdelim);
+		}
+		output = output->next;
+	}
+
+	if(isalnum(d->quote))
+	{
+		fail(d->failure, ERR_CODE_BDQ, "%c is not a valid quote.", d->quote);
+	}
+
+	output = d->outputs;
+	while(output != NULL)
+	{
+		if(isalnum(output->outquote))
+		{
+			fail(d->failure, ERR_CODE_BDQ, "%c is not a valid quote.", output->outquote);
+		}
+		output = output->next;
+	}
+
+	if(d->delim == d->quote)
+	{
+		fail(d->failure, ERR_CODE_EQD, "%c used as quote and delimiter.", d->quote);
+	}
+	
+	output = d->outputs;
+	while(output != NULL)
+	{
+		if(output->outdelim == output->outquote)
+		{
+			fail(d->failure, ERR_CODE_EQD, "%c used as quote and delimiter.", output->outquote);
+		}
+		output = output->next;
+	}
+	
+	output = d->outputs;
+	while(output != NULL)
+	{
+		if(output->num_keys == 0)
+		{
+			if((output->rev == false) && (output->all == false))
+			{
+				fail(d->failure, ERR_CODE_NKY, "no keys specified.");
+			}
+		}
+		output = output->next;
+	}
+}
+
+//work out which columns the outputs use, so the parser can pass over the
+//others; -a and -r use every column
+static void plan_columns(struct data *d)
+{
+	struct output_file* output;
+	size_t ndx;
+	int all = false;
+
+	d->needed = 0;
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		if(output->all == true || output->rev == true)
+		{
+			all = true;
+		}
+		for(ndx = 0; ndx < output->num_keys; ++ndx)
+		{
+			if((size_t)output->keyorder[ndx] >= d->needed)
+			{
+				d->needed = output->keyorder[ndx] + 1;
+			}
+		}
+		for(ndx = 0; ndx < output->num_where; ++ndx)
+		{
+			if(output->where[ndx].column >= d->needed)
+			{
+				d->needed = output->where[ndx].column + 1;
+			}
+		}
+		for(ndx = 0; ndx < output->num_part_columns; ++ndx)
+		{
+			if(output->part_columns[ndx] >= d->needed)
+			{
+				d->needed = output->part_columns[ndx] + 1;
+			}
+		}
+		for(ndx = 0; ndx < output->num_sort_columns; ++ndx)
+		{
+			if(output->sort_columns[ndx] >= d->needed)
+			{
+				d->needed = output->sort_columns[ndx] + 1;
+			}
+		}
+	}
+
+	//the batch keeps the columns named past a short first row for -a too
+	d->reach = d->needed;
+	if(all)
+	{
+		d->needed = SIZE_MAX;
+		return;
+	}
+
+	d->wanted = calloc(d->needed ? d->needed : 1, sizeof(char));
+	if(d->wanted == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+	}
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		for(ndx = 0; ndx < output->num_keys; ++ndx)
+		{
+			d->wanted[output->keyorder[ndx]] = true;
+		}
+		for(ndx = 0; ndx < output->num_where; ++ndx)
+		{
+			d->wanted[output->where[ndx].column] = true;
+		}
+		for(ndx = 0; ndx < output->num_part_columns; ++ndx)
+		{
+			d->wanted[output->part_columns[ndx]] = true;
+		}
+		for(ndx = 0; ndx < output->num_sort_columns; ++ndx)
+		{
+			d->wanted[output->sort_columns[ndx]] = true;
+		}
+	}
+}
+
+//pick the row writer of every output once, instead of checking -a, -r and
+//the keys on every row
+static void plan_emit(struct data *d)
+{
+	struct output_file* output;
+	size_t ndx;
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		output->num_columns = output->num_keys;
+		output->columns = malloc((output->num_keys ? output->num_keys : 1) * sizeof(size_t));
+		if(output->columns == NULL)
+		{
+			fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+		}
+		for(ndx = 0; ndx < output->num_keys; ++ndx)
+		{
+			output->columns[ndx] = output->keyorder[ndx];
+		}
+
+		//-a wins over -r, which wins over keys
+		if(output->format == FORMAT_LENPREFIX)
+		{
+			output->emit = emit_lenprefix;
+		}
+		else if(output->format == FORMAT_COLUMNAR)
+		{
+			output->emit = emit_columnar;
+		}
+		else if(output->all == true)
+		{
+			output->emit = emit_all;
+		}
+		else if(output->rev == true)
+		{
+			output->emit = emit_reverse;
+		}
+		else
+		{
+			for(ndx = 1; ndx < output->num_columns &&
+						 output->columns[ndx] == output->columns[0] + ndx; ++ndx);
+			output->emit = (ndx == output->num_columns) ? emit_range : emit_columns;
+		}
+	}
+}
+
+//open the files of -f names holding a %, which are left until now since
+//with --partitions they name one file per partition
+static void plan_partitions(struct data *d)
+{
+	struct output_file* output;
+	char path[4096];
+	const char* p;
+	int fd;
+	size_t convs;
+	size_t ndx;
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		if((output->num_parts > 0) != (output->num_part_columns > 0))
+		{
+			fail(d->failure, ERR_CODE_OPT, "--partitions and --partition-by go together.");
+		}
+		if(!output->deferred)
+		{
+			if(output->num_parts > 0)
+			{
+				fail(d->failure, ERR_CODE_OPT, "%s needs a %%d for the partition number.", output->name);
+			}
+			continue;
+		}
+
+		if(output->num_parts == 0)
+		{
+			output->outfile = fopen(output->name, "w");
+			if(output->outfile == NULL)
+			{
+				fail(d->failure, ERR_CODE_FIL, "File %s failed to open.", output->name);
+			}
+			output->sink->fd = fileno(output->outfile);
+			continue;
+		}
+
+		//the name is a format, so it must hold exactly one %d (%% aside)
+		for(convs = 0, p = strchr(output->name, '%'); p != NULL; p = strchr(p + 1, '%'))
+		{
+			if(p[1] == '%')
+			{
+				++p;
+				continue;
+			}
+			for(++p; *p == '0' || *p == '-' || isdigit(*p); ++p);
+			if(*p != 'd')
+			{
+				convs = 0;
+				break;
+			}
+			++convs;
+		}
+		if(convs != 1)
+		{
+			fail(d->failure, ERR_CODE_OPT, "%s needs exactly one %%d for the partition number.", output->name);
+		}
+
+		output->parts = malloc(output->num_parts * sizeof(struct out_buffer));
+		if(output->parts == NULL)
+		{
+			fail(d->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+		}
+		//every part is set up first, so a job that fails here frees them all
+		for(ndx = 0; ndx < output->num_parts; ++ndx)
+		{
+			sink_init(&output->parts[ndx], -1, output->sink->codec, d->failure);
+		}
+		for(ndx = 0; ndx < output->num_parts; ++ndx)
+		{
+			snprintf(path, sizeof(path), output->name, (int)ndx);
+			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+			if(fd < 0)
+			{
+				fail(d->failure, ERR_CODE_FIL, "File %s failed to open.", path);
+			}
+			output->parts[ndx].fd = fd;
+		}
+		output->sink = &output->parts[0];
+	}
+}
+
+static void fileAssign(struct data *d, char *optarg)
+{
+	struct output_file* output;
+	int codec;
+
+	//fprintf(stderr, "optarg to fileAssign: %s\n", optarg);
+	output_new(d, optarg);
+
+	//before the file is created, so an unsupported one is not left behind
+	codec = codec_name(optarg, d->failure);
+	if(strcmp(optarg, "") == 0)
+	{
+		d->last->outfile = stdout;
+		optarg = "stdout";
+	}
+	else if(strchr(optarg, '%') != NULL)
+	{
+		//may name partitions; opened by plan_partitions()
+		d->last->deferred = true;
+	}
+	else
+	{
+		d->last->outfile = fopen(optarg, "w");
+		if(d->last->outfile == NULL)
+		{
+			fail(d->failure, ERR_CODE_FIL, "File %s failed to open.", optarg);
+		}
+	}
+
+	//outputs to stdout share its buffer so their rows stay interleaved
+	for(output = d->outputs; output != d->last && output->outfile != d->last->outfile; output = output->next);
+	if(output != d->last && d->last->outfile != NULL)
+	{
+		d->last->sink = output->sink;
+	}
+	else
+	{
+		d->last->sink = malloc(sizeof(struct out_buffer));
+		if(d->last->sink == NULL)
+		{
+			fail(d->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+		}
+		d->last->own_sink = d->last->sink;
+		sink_init(d->last->sink, d->last->outfile ? fileno(d->last->outfile) : -1, codec, d->failure);
+	}
+	d->last->name = optarg;
+
+	//fprintf(stderr, "leaving fileAssign: %s\n", optarg);
+}
+
+//append an output with the defaults to d's list; its sink is set by the caller
+static struct output_file* output_new(struct data *d, const char *name)
+{
+	struct output_file* output = malloc(sizeof(struct output_file));
+
+	if(output == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+	}
+	if(d->outputs == NULL)
+	{
+		d->outputs = output;
+	}
+	else
+	{
+		d->last->next = output;
+	}
+	d->last = output;
+
+	d->last->outfile = NULL;
+	d->last->deferred = false;
+	d->last->sink = NULL;
+	d->last->own_sink = NULL;
+	d->last->name = name;
+	d->last->bytes = 0;
+	d->last->part_bytes = 0;
+	d->last->emit_time = 0;
+	d->last->keyorder = NULL;
+	d->last->num_keys = 0;
+	d->last->columns = NULL;
+	d->last->num_columns = 0;
+	d->last->interleave = false;
+	d->last->where = NULL;
+	d->last->num_where = 0;
+	d->last->parts = NULL;
+	d->last->num_parts = 0;
+	d->last->part_columns = NULL;
+	d->last->num_part_columns = 0;
+	d->last->sort_columns = NULL;
+	d->last->num_sort_columns = 0;
+	d->last->sort = NULL;
+	d->last->distinct = false;
+	d->last->format = FORMAT_CSV;
+	d->last->dedup = NULL;
+	d->last->outdelim = d->delim;
+	d->last->outquote = d->quote;
+	d->last->rev = false;
+	d->last->all = false;
+	d->last->next = NULL;
+
+	return output;
+}
+
+static void keyAssign(struct data *d, char *optarg)
+{
+	int new_key = atoi(optarg);
+	//fprintf(stderr, "new key: %i\n", new_key);
+
+	if(new_key < 1)
+	{
+		fail(d->failure, ERR_CODE_KOR, "key value %i is too low", new_key);
+	}
+
+	if(d->outputs == NULL)
+	{
+		fileAssign(d, "");
+	}
+
+	--new_key;
+	
+	d->last->num_keys++;
+	d->last->keyorder = realloc(d->last->keyorder, d->last->num_keys * sizeof(int));
+	d->last->keyorder[(d->last->num_keys) - 1] = new_key;
+}
+
+//a column whose value picks the partition of a row, for the last output
+static void partAssign(struct data *d, char *optarg)
+{
+	int new_key = atoi(optarg);
+
+	if(new_key < 1)
+	{
+		fail(d->failure, ERR_CODE_KOR, "key value %i is too low", new_key);
+	}
+
+	if(d->outputs == NULL)
+	{
+		fileAssign(d, "");
+	}
+
+	d->last->num_part_columns++;
+	d->last->part_columns = realloc(d->last->part_columns, d->last->num_part_columns * sizeof(size_t));
+	if(d->last->part_columns == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+	}
+	d->last->part_columns[d->last->num_part_columns - 1] = new_key - 1;
+}
+
+//A:B, the records (from 1) to write; either end may be left out
+static void rowsAssign(struct data *d, char *optarg)
+{
+	char* colon = strchr(optarg, ':');
+	char* end;
+	size_t first = 1;
+	size_t last = SIZE_MAX;
+
+	if(colon == NULL)
+	{
+		fail(d->failure, ERR_CODE_OPT, "invalid value %s for --rows.", optarg);
+	}
+	if(colon > optarg)
+	{
+		first = strtoull(optarg, &end, 10);
+		if(end != colon || first < 1)
+		{
+			fail(d->failure, ERR_CODE_OPT, "invalid value %s for --rows.", optarg);
+		}
+	}
+	if(colon[1] != '\0')
+	{
+		last = strtoull(colon + 1, &end, 10);
+		if(*end != '\0' || last < first)
+		{
+			fail(d->failure, ERR_CODE_OPT, "invalid value %s for --rows.", optarg);
+		}
+	}
+
+	d->first_row = first;
+	d->num_rows = last - first + 1;
+}
+
+//N=value, N!=value, N~prefix or N!~prefix, for the last output
+static void whereAssign(struct data *d, char *optarg)
+{
+	struct where_clause* w;
+	char* test;
+	long column = strtol(optarg, &test, 10);
+
+	if(test == optarg || column < 1)
+	{
+		fail(d->failure, ERR_CODE_KOR, "--where %s does not start with a valid key.", optarg);
+	}
+
+	if(d->outputs == NULL)
+	{
+		fileAssign(d, "");
+	}
+
+	d->last->num_where++;
+	d->last->where = realloc(d->last->where, d->last->num_where * sizeof(struct where_clause));
+	if(d->last->where == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+	}
+	w = &d->last->where[d->last->num_where - 1];
+	w->column = column - 1;
+
+	if(strncmp(test, "!=", 2) == 0)
+	{
+		w->test = WHERE_NE;
+		w->value = test + 2;
+	}
+	else if(strncmp(test, "!~", 2) == 0)
+	{
+		w->test = WHERE_NO_PREFIX;
+		w->value = test + 2;
+	}
+	else if(*test == '=')
+	{
+		w->test = WHERE_EQ;
+		w->value = test + 1;
+	}
+	else if(*test == '~')
+	{
+		w->test = WHERE_PREFIX;
+		w->value = test + 1;
+	}
+	else
+	{
+		fail(d->failure, ERR_CODE_OPT, "invalid value %s for --where.", optarg);
+	}
+	w->len = strlen(w->value);
+}
+
+//write a field quoted the way csv_fwrite2 does, doubling embedded quotes
+static void out_field(struct output_file *o, const char *src, size_t n)
+{
+	struct out_buffer* b = o->sink;
+	const char* quote;
+	char* dest;
+
+	if(src == NULL)
+	{
+		return;
+	}
+
+	quote = memchr(src, o->outquote, n);
+	out_reserve(b, (quote == NULL) ? n + 2 : 2 * n + 2);
+	dest = b->buff + b->len;
+	*dest++ = o->outquote;
+	if(quote == NULL)
+	{
+		memcpy(dest, src, n);
+		dest += n;
+	}
+	else
+	{
+		//the part before the first quote needs no escaping
+		memcpy(dest, src, quote - src);
+		dest += quote - src;
+		for(n -= quote - src, src = quote; n > 0; --n, ++src)
+		{
+			if(*src == o->outquote)
+			{
+				*dest++ = o->outquote;
+			}
+			*dest++ = *src;
+		}
+	}
+	*dest++ = o->outquote;
+	b->len = dest - b->buff;
+}
+
+static void out_char(struct output_file *o, char c)
+{
+	struct out_buffer* b = o->sink;
+
+	if(b->len == b->capacity)
+	{
+		out_reserve(b, 1);
+	}
+	b->buff[b->len++] = c;
+}
+
+//make room for n more bytes, writing out what is held if the output has
+//a destination and growing the buffer otherwise
+static void out_reserve(struct out_buffer *b, size_t n)
+{
+	size_t capacity;
+
+	if(b->len + n <= b->capacity)
+	{
+		return;
+	}
+
+	out_flush(b);
+	if(b->len + n > b->capacity)
+	{
+		capacity = b->capacity ? 2 * b->capacity : OUTBUF_SIZE;
+		while(capacity < b->len + n)
+		{
+			capacity *= 2;
+		}
+		b->buff = realloc(b->buff, capacity);
+		if(b->buff == NULL)
+		{
+			fail(b->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+		}
+		b->capacity = capacity;
+	}
+}
+
+//rows kept in memory stay where they are
+static void out_flush(struct out_buffer *b)
+{
+	if(b->fd >= 0 || b->write != NULL)
+	{
+		out_commit(b, b);
+	}
+}
+
+//write the rows held in src to dest's file, through its writer if it has
+//one, or hand them to its callback; an output kept in memory gets a copy
+static void out_commit(struct out_buffer *dest, struct out_buffer *src)
+{
+	int err;
+
+	src->flushed += src->len;
+	if(dest->queue != NULL)
+	{
+		queue_push(dest->queue, src);
+		return;
+	}
+
+	if(dest->write != NULL)
+	{
+		if(src->len > 0 && dest->write(dest->ctx, src->buff, src->len) != 0)
+		{
+			fail(dest->failure, ERR_CODE_FIL, "an output callback failed.");
+		}
+	}
+	else if(dest->fd >= 0)
+	{
+		err = out_write(dest->fd, src->buff, src->len);
+		if(err != 0)
+		{
+			fail(dest->failure, ERR_CODE_FIL, "failed writing output: %s.", strerror(err));
+		}
+	}
+	else
+	{
+		out_reserve(dest, src->len);
+		memcpy(dest->buff + dest->len, src->buff, src->len);
+		dest->len += src->len;
+	}
+	src->len = 0;
+}
+
+static void sink_init(struct out_buffer *b, int fd, int codec, struct failure *f)
+{
+	b->fd = fd;
+	b->write = NULL;
+	b->ctx = NULL;
+	b->failure = f;
+	b->buff = NULL;
+	b->len = 0;
+	b->capacity = 0;
+	b->queue = NULL;
+	b->flushed = 0;
+	b->codec = codec;
+}
+
+//returns 0, or errno if the write failed
+static int out_write(int fd, const char *buff, size_t len)
+{
+	ssize_t written;
+
+	while(len > 0)
+	{
+		written = write(fd, buff, len);
+		if(written < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+		buff += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+//give every output file its own writer thread, so that a slow file only
+//holds up the parser once num_blocks buffers for it are waiting; compressed
+//files get num_workers of them, and always have some, even with no queue
+static void output_start(struct data *d, size_t num_blocks, size_t num_workers)
+{
+	struct output_file* output;
+	size_t ndx;
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		//the partitions of an output share its compressing threads
+		for(ndx = 0; ndx < output->num_parts; ++ndx)
+		{
+			queue_start(&output->parts[ndx], num_blocks,
+						(num_workers > output->num_parts) ? num_workers / output->num_parts : 1);
+			format_header(output, &output->parts[ndx]);
+		}
+		if(output->num_parts == 0)
+		{
+			queue_start(output_sink(output), num_blocks, num_workers);
+			format_header(output, output_sink(output));
+		}
+	}
+}
+
+//start a binary output's file with its magic, ahead of any rows
+static void format_header(struct output_file *o, struct out_buffer *sink)
+{
+	const char* magic = (o->format == FORMAT_LENPREFIX) ? CSVREO_LENPREFIX_MAGIC : CSVREO_COLUMNAR_MAGIC;
+
+	if(o->format == FORMAT_CSV)
+	{
+		return;
+	}
+
+	out_reserve(sink, strlen(magic));
+	memcpy(sink->buff + sink->len, magic, strlen(magic));
+	sink->len += strlen(magic);
+	out_flush(sink);
+}
+
+//write what is left in the output buffers and wait for the writers
+static void output_finish(struct data *d)
+{
+	struct output_file* output;
+	size_t ndx;
+
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		for(ndx = 0; ndx < output->num_parts; ++ndx)
+		{
+			queue_finish(&output->parts[ndx]);
+		}
+		if(output->dedup != NULL)
+		{
+			distinct_finish(output, d->stats);
+		}
+		if(output->sort != NULL)
+		{
+			sort_finish(output, d->stats);
+		}
+		else if(output->num_parts == 0 && output->dedup == NULL)
+		{
+			queue_finish(output->sink);
+		}
+	}
+}
+
+static void queue_start(struct out_buffer *sink, size_t num_blocks, size_t num_workers)
+{
+	struct out_queue* q;
+	size_t ndx;
+
+	//outputs sharing a buffer share its writer; callbacks and memory have none
+	if(sink->queue != NULL || sink->fd < 0 || sink->write != NULL ||
+	   (num_blocks == 0 && sink->codec == CODEC_NONE))
+	{
+		return;
+	}
+
+	q = malloc(sizeof(struct out_queue));
+	if(q == NULL)
+	{
+		fail(sink->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+	}
+
+	//every compressing writer needs a buffer of its own to work on
+	q->num_workers = 1;
+	if(sink->codec != CODEC_NONE)
+	{
+		q->num_workers = num_workers ? num_workers : 1;
+		if(num_blocks < 2 * q->num_workers)
+		{
+			num_blocks = 2 * q->num_workers;
+		}
+	}
+	q->blocks = calloc(num_blocks, sizeof(struct out_buffer));
+	if(q->blocks == NULL)
+	{
+		fail(sink->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+	}
+	q->num_blocks = num_blocks;
+	q->head = 0;
+	q->count = 0;
+	q->claimed = 0;
+	q->written = 0;
+	q->packed = 0;
+	q->fd = sink->fd;
+	q->codec = sink->codec;
+	q->done = false;
+	q->stalls = 0;
+	q->error = ERR_CODE_AOK;
+	q->failure = sink->failure;
+	q->ids = malloc(q->num_workers * sizeof(pthread_t));
+	if(q->ids == NULL)
+	{
+		fail(sink->failure, ERR_CODE_MEM, "unable to allocate thread data.");
+	}
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	pthread_cond_init(&q->turn, NULL);
+	sink->queue = q;
+
+	for(ndx = 0; ndx < q->num_workers; ++ndx)
+	{
+		if(pthread_create(&q->ids[ndx], NULL, thread_output_write, q) != 0)
+		{
+			q->num_workers = ndx;
+			fail(sink->failure, ERR_CODE_PTH, "unable to create a thread: %s.", strerror(errno));
+		}
+	}
+}
+
+static void queue_finish(struct out_buffer *sink)
+{
+	struct out_queue* q = sink->queue;
+	char* packed = NULL;
+	size_t capacity = 0;
+	size_t len;
+	size_t ndx;
+
+	if(sink->len > 0)
+	{
+		out_flush(sink);
+	}
+	if(q == NULL || q->done)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&q->lock);
+	q->done = true;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+	for(ndx = 0; ndx < q->num_workers; ++ndx)
+	{
+		pthread_join(q->ids[ndx], NULL);
+	}
+
+	//a compressed file with no rows still needs to decompress to nothing
+	if(q->codec != CODEC_NONE && q->packed == 0 && q->error == ERR_CODE_AOK)
+	{
+		len = block_compress(q->codec, "", 0, &packed, &capacity);
+		queue_write(q, packed, len);
+		free(packed);
+	}
+
+	if(q->error != ERR_CODE_AOK)
+	{
+		fail(sink->failure, q->error, "%s", q->message);
+	}
+}
+
+//write a block for a writer, or note why it could not be (len SIZE_MAX:
+//it was not compressed); once one fails the rest are dropped
+static void queue_write(struct out_queue *q, const char *buff, size_t len)
+{
+	char message[sizeof(q->message)];
+	int err = 0;
+
+	if(q->error != ERR_CODE_AOK)
+	{
+		return;
+	}
+
+	if(len == SIZE_MAX)
+	{
+		snprintf(message, sizeof(message), "failed compressing output.");
+	}
+	else if((err = out_write(q->fd, buff, len)) != 0)
+	{
+		snprintf(message, sizeof(message), "failed writing output: %s.", strerror(err));
+	}
+	else
+	{
+		return;
+	}
+
+	//a writer has no call to return the error from, so it goes straight to
+	//the job, whose threads stop; queue_push() and queue_finish() raise it
+	//again where the rows are queued
+	failure_record(q->failure, ERR_CODE_FIL, message);
+	pthread_mutex_lock(&q->lock);
+	q->error = ERR_CODE_FIL;
+	memcpy(q->message, message, sizeof(message));
+	pthread_mutex_unlock(&q->lock);
+}
+
+//stop sink's writers, if queue_finish() has not, and free its queue
+static void queue_free(struct out_buffer *sink)
+{
+	struct out_queue* q = sink->queue;
+	size_t ndx;
+
+	if(q == NULL)
+	{
+		return;
+	}
+
+	if(!q->done)
+	{
+		pthread_mutex_lock(&q->lock);
+		q->done = true;
+		pthread_cond_broadcast(&q->not_empty);
+		pthread_mutex_unlock(&q->lock);
+		for(ndx = 0; ndx < q->num_workers; ++ndx)
+		{
+			pthread_join(q->ids[ndx], NULL);
+		}
+	}
+
+	for(ndx = 0; ndx < q->num_blocks; ++ndx)
+	{
+		free(q->blocks[ndx].buff);
+	}
+	free(q->blocks);
+	free(q->ids);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->turn);
+	free(q);
+	sink->queue = NULL;
+}
+
+//queue the rows in src for writing; src gets an empty buffer in exchange
+static void queue_push(struct out_queue *q, struct out_buffer *src)
+{
+	struct out_buffer* block;
+	char* buff;
+	size_t capacity;
+
+	pthread_mutex_lock(&q->lock);
+	if(q->error != ERR_CODE_AOK)
+	{
+		pthread_mutex_unlock(&q->lock);
+		fail(src->failure, q->error, "%s", q->message);
+	}
+	if(q->count == q->num_blocks)
+	{
+		q->stalls++;
+	}
+	while(q->count == q->num_blocks)
+	{
+		pthread_cond_wait(&q->not_full, &q->lock);
+	}
+
+	block = &q->blocks[(q->head + q->count) % q->num_blocks];
+	buff = block->buff;
+	capacity = block->capacity;
+	block->buff = src->buff;
+	block->capacity = src->capacity;
+	block->len = src->len;
+	src->buff = buff;
+	src->capacity = capacity;
+	src->len = 0;
+
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void* thread_output_write(void* data_ptr)
+{
+	struct out_queue* q = (struct out_queue*)data_ptr;
+	struct out_buffer* block;
+	size_t seq;
+	const char* buff;
+	size_t len;
+	char* packed = NULL;
+	size_t capacity = 0;
+
+	pthread_mutex_lock(&q->lock);
+	for(;;)
+	{
+		while(q->claimed == q->count && !q->done)
+		{
+			pthread_cond_wait(&q->not_empty, &q->lock);
+		}
+		if(q->claimed == q->count)
+		{
+			break;
+		}
+
+		//the block stays queued, and so untouched, until it is written
+		block = &q->blocks[(q->head + q->claimed) % q->num_blocks];
+		seq = q->written + q->claimed;
+		q->claimed++;
+		pthread_mutex_unlock(&q->lock);
+
+		buff = block->buff;
+		len = block->len;
+		if(q->codec != CODEC_NONE && len > 0)
+		{
+			len = block_compress(q->codec, block->buff, block->len, &packed, &capacity);
+			buff = packed;
+			__atomic_fetch_add(&q->packed, 1, __ATOMIC_RELAXED);
+		}
+
+		//blocks are written in the order they were queued; only the writer
+		//whose turn it is touches the error
+		pthread_mutex_lock(&q->lock);
+		while(q->written != seq)
+		{
+			pthread_cond_wait(&q->turn, &q->lock);
+		}
+		pthread_mutex_unlock(&q->lock);
+		queue_write(q, buff, len);
+		pthread_mutex_lock(&q->lock);
+
+		q->head = (q->head + 1) % q->num_blocks;
+		q->count--;
+		q->claimed--;
+		q->written++;
+		pthread_cond_broadcast(&q->turn);
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+	free(packed);
+
+	return NULL;
+}
+
+//compress a block on its own (as a whole gzip member or zstd frame), so
+//blocks can be compressed in any order and their output simply joined;
+//returns SIZE_MAX if it could not be
+static size_t block_compress(int codec, const char *src, size_t len, char **dst, size_t *capacity)
+{
+	z_stream z;
+	size_t bound;
+
+	memset(&z, 0, sizeof(z));
+	if(codec == CODEC_GZIP)
+	{
+		//31: deflate with a gzip header and trailer
+		if(deflateInit2(&z, GZIP_LEVEL, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			return SIZE_MAX;
+		}
+		bound = deflateBound(&z, len);
+	}
+	else
+	{
+#ifdef HAVE_ZSTD
+		bound = ZSTD_compressBound(len);
+#else
+		bound = 0;
+#endif
+	}
+
+	if(bound > *capacity)
+	{
+		free(*dst);
+		*dst = malloc(bound);
+		*capacity = (*dst == NULL) ? 0 : bound;
+		if(*dst == NULL)
+		{
+			if(codec == CODEC_GZIP)
+			{
+				deflateEnd(&z);
+			}
+			return SIZE_MAX;
+		}
+	}
+
+	if(codec == CODEC_GZIP)
+	{
+		z.next_in = (Bytef*)src;
+		z.avail_in = len;
+		z.next_out = (Bytef*)*dst;
+		z.avail_out = bound;
+		if(deflate(&z, Z_FINISH) != Z_STREAM_END)
+		{
+			deflateEnd(&z);
+			return SIZE_MAX;
+		}
+		deflateEnd(&z);
+		return z.total_out;
+	}
+
+#ifdef HAVE_ZSTD
+	bound = ZSTD_compress(*dst, bound, src, len, ZSTD_LEVEL);
+	if(ZSTD_isError(bound))
+	{
+		return SIZE_MAX;
+	}
+#endif
+	return bound;
+}
+
+static void* thread_io_scan(void* data_ptr)
+{
+	struct thread_data* data = (struct thread_data*)data_ptr;
+	jmp_buf jump;
+
+	//an error stops the reader too (see fail())
+	if(setjmp(jump) == 0)
+	{
+		caught = &jump;
+		io_scan(data);
+	}
+	else
+	{
+		__atomic_store_n(&data->dat->stop, true, __ATOMIC_RELAXED);
+		ring_abort(data->ring);
+	}
+	caught = NULL;
+
+	return NULL;
+}
+
+//parse slots in the order they were filled until the reader is done
+static void io_scan(struct thread_data *data)
+{
+	struct buffer_ring* ring = data->ring;
+	long seq;
+
+	double start;
+
+	while((seq = ring_acquire_full(ring)) >= 0)
+	{
+		if(data->dat->stop)
+		{
+			ring_release(ring);
+			continue;
+		}
+		start = data->dat->stats ? now() : 0;
+		stream_parse(data->stream,
+					 ring->buff[seq % ring->num_slots],
+					 ring->size[seq % ring->num_slots],
+					 data->dat);
+		if(data->dat->stats)
+		{
+			data->dat->timing.parse_time += now() - start;
+		}
+		ring_release(ring);
+	}
+}
+
+//map a regular input file; other inputs are opened for reading instead
+static const char* map_input(struct data *d, char *path, size_t *len)
+{
+	struct stat st;
+	void* map = MAP_FAILED;
+
+	d->infile = fopen(path, "r");
+	if(d->infile == NULL)
+	{
+		fail(d->failure, ERR_CODE_FIL, "File %s failed to open.", path);
+	}
+
+	if(fstat(fileno(d->infile), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(d->infile), 0);
+	}
+	if(map == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	*len = st.st_size;
+
+	return map;
+}
+
+//tell gzip and zstd input from plain input by their magic numbers
+static int codec_detect(const unsigned char *p, size_t len)
+{
+	if(len >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+	{
+		return CODEC_GZIP;
+	}
+	if(len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+	{
+		return CODEC_ZSTD;
+	}
+
+	return CODEC_NONE;
+}
+
+//output files ending in .gz or .zst are compressed
+static int codec_name(const char *path, struct failure *f __attribute__ ((unused)))
+{
+	size_t len = strlen(path);
+	int codec = CODEC_NONE;
+
+	if(len > 3 && strcmp(path + len - 3, ".gz") == 0)
+	{
+		codec = CODEC_GZIP;
+	}
+	else if(len > 4 && strcmp(path + len - 4, ".zst") == 0)
+	{
+		codec = CODEC_ZSTD;
+	}
+
+#ifndef HAVE_ZSTD
+	if(codec == CODEC_ZSTD)
+	{
+		fail(f, ERR_CODE_OPT, "%s needs zstd, but csvreo was built without it (-DHAVE_ZSTD).", path);
+	}
+#endif
+
+	return codec;
+}
+
+//set up reading the input from file, or from map if it is a compressed
+//mapping; the first bytes are read to see whether file is compressed
+static void input_open(struct in_codec *c, FILE *file, const char *map, size_t map_len, struct failure *f)
+{
+	c->failure = f;
+	c->file = file;
+	c->fd = fileno(file);
+	c->map = map;
+	c->map_len = map_len;
+	c->map_pos = 0;
+	c->next = NULL;
+	c->avail = 0;
+	c->open = false;
+
+	c->in = malloc(BUFSIZE);
+	if(c->in == NULL)
+	{
+		fail(c->failure, ERR_CODE_MEM, "unable to allocate input buffer.");
+	}
+
+	if(map != NULL)
+	{
+		c->kind = codec_detect((const unsigned char*)map, map_len);
+	}
+	else
+	{
+		//what is read here is handed out first, compressed or not
+		c->next = c->in;
+		c->avail = input_raw(c, c->in, 4, 4);
+		c->kind = codec_detect((const unsigned char*)c->in, c->avail);
+	}
+
+	memset(&c->z, 0, sizeof(c->z));
+	if(c->kind == CODEC_GZIP)
+	{
+		//47: gzip or zlib, told apart by the header
+		if(inflateInit2(&c->z, 47) != Z_OK)
+		{
+			fail(c->failure, ERR_CODE_MEM, "unable to allocate decompression buffers.");
+		}
+	}
+	else if(c->kind == CODEC_ZSTD)
+	{
+#ifdef HAVE_ZSTD
+		c->zd = ZSTD_createDStream();
+		if(c->zd == NULL || ZSTD_isError(ZSTD_initDStream(c->zd)))
+		{
+			fail(c->failure, ERR_CODE_MEM, "unable to allocate decompression buffers.");
+		}
+#else
+		//the caller only closes inputs that opened
+		free(c->in);
+		c->in = NULL;
+		fail(c->failure, ERR_CODE_FIL, "the input is zstd compressed, but csvreo was built without zstd (-DHAVE_ZSTD).");
+#endif
+	}
+}
+
+//get more compressed bytes; false at the end of the input
+static int input_fill(struct in_codec *c)
+{
+	size_t len;
+
+	if(c->map != NULL)
+	{
+		//zlib counts in unsigned ints, so a mapping is handed out in pieces
+		len = c->map_len - c->map_pos;
+		if(len > 1 << 30)
+		{
+			len = 1 << 30;
+		}
+		c->next = c->map + c->map_pos;
+		c->map_pos += len;
+	}
+	else
+	{
+		len = input_raw(c, c->in, BUFSIZE, 1);
+		c->next = c->in;
+	}
+	c->avail = len;
+
+	return len > 0;
+}
+
+//read up to len bytes of c's file into buff: at least want of them unless
+//the input ends first, and after that only what is ready, so a pipe that
+//stalls hands on what it has instead of holding it back for a whole buffer
+static size_t input_raw(struct in_codec *c, char *buff, size_t len, size_t want)
+{
+	size_t n = 0;
+	ssize_t got;
+
+	while(n < len && (n < want || input_ready(c)))
+	{
+		got = read(c->fd, buff + n, len - n);
+		if(got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(got < 0)
+		{
+			fail(c->failure, ERR_CODE_FIL, "failed reading input: %s.", strerror(errno));
+		}
+		if(got == 0)
+		{
+			break;
+		}
+		n += got;
+	}
+
+	return n;
+}
+
+//whether a read of c's file would return at once (regular files always do)
+static int input_ready(struct in_codec *c)
+{
+	struct pollfd ready;
+
+	ready.fd = c->fd;
+	ready.events = POLLIN;
+
+	return poll(&ready, 1, 0) > 0;
+}
+
+//fill buff with up to len bytes of (decompressed) input; fewer when a pipe
+//has no more ready, and none only at the end of the input
+static size_t input_read(struct in_codec *c, char *buff, size_t len)
+{
+	size_t n = 0;
+	int ret;
+
+	if(c->kind == CODEC_NONE)
+	{
+		if(c->avail > 0)
+		{
+			n = (c->avail < len) ? c->avail : len;
+			memcpy(buff, c->next, n);
+			c->next += n;
+			c->avail -= n;
+		}
+		return n + input_raw(c, buff + n, len - n, n == 0);
+	}
+
+	while(n < len)
+	{
+		//what has been decompressed goes on rather than wait for more input
+		if(c->avail == 0 && n > 0 && c->map == NULL && !input_ready(c))
+		{
+			break;
+		}
+		if(c->avail == 0 && !input_fill(c))
+		{
+			if(c->open)
+			{
+				fail(c->failure, ERR_CODE_FIL, "compressed input is truncated.");
+			}
+			break;
+		}
+		c->open = true;
+
+		if(c->kind == CODEC_GZIP)
+		{
+			c->z.next_in = (Bytef*)c->next;
+			c->z.avail_in = c->avail;
+			c->z.next_out = (Bytef*)buff + n;
+			c->z.avail_out = len - n;
+			ret = inflate(&c->z, Z_NO_FLUSH);
+			n = len - c->z.avail_out;
+			c->next = (const char*)c->z.next_in;
+			c->avail = c->z.avail_in;
+
+			//concatenated members (as written by .gz outputs) follow
+			if(ret == Z_STREAM_END)
+			{
+				inflateReset(&c->z);
+				c->open = false;
+			}
+			else if(ret != Z_OK && ret != Z_BUF_ERROR)
+			{
+				fail(c->failure, ERR_CODE_FIL, "failed decompressing input: %s.", c->z.msg ? c->z.msg : "bad data");
+			}
+		}
+#ifdef HAVE_ZSTD
+		else
+		{
+			ZSTD_inBuffer in = {c->next, c->avail, 0};
+			ZSTD_outBuffer out = {buff, len, n};
+			size_t left = ZSTD_decompressStream(c->zd, &out, &in);
+
+			if(ZSTD_isError(left))
+			{
+				fail(c->failure, ERR_CODE_FIL, "failed decompressing input: %s.", ZSTD_getErrorName(left));
+			}
+			n = out.pos;
+			c->next += in.pos;
+			c->avail -= in.pos;
+			c->open = (left != 0);
+		}
+#endif
+	}
+
+	return n;
+}
+
+static void input_close(struct in_codec *c)
+{
+	if(c->kind == CODEC_GZIP)
+	{
+		inflateEnd(&c->z);
+	}
+#ifdef HAVE_ZSTD
+	else if(c->kind == CODEC_ZSTD)
+	{
+		ZSTD_freeDStream(c->zd);
+	}
+#endif
+	free(c->in);
+	c->in = NULL;
+}
+
+//set up u to read path into the slots of r; false if io_uring cannot be
+//used here, in which case the input is read the usual way
+static int uring_open(struct uring_reader *u, const char *path, struct buffer_ring *r, int direct, struct failure *f)
+{
+#ifdef HAVE_URING
+	struct io_uring_params p;
+	struct iovec* slots;
+	struct stat st;
+	size_t idx;
+
+	memset(u, 0, sizeof(struct uring_reader));
+	u->failure = f;
+
+	//O_DIRECT is not supported by every file system
+	u->file = direct ? open(path, O_RDONLY | O_DIRECT) : -1;
+	u->direct = (u->file >= 0);
+	if(u->file < 0)
+	{
+		u->file = open(path, O_RDONLY);
+	}
+	if(u->file < 0 || fstat(u->file, &st) != 0)
+	{
+		fail(f, ERR_CODE_FIL, "File %s failed to open.", path);
+	}
+	u->size = st.st_size;
+
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, (unsigned)r->num_slots, &p);
+	if(u->fd < 0)
+	{
+		close(u->file);
+		return false;
+	}
+	u->entries = p.sq_entries;
+
+	u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	u->got = calloc(r->num_slots, sizeof(size_t));
+	if(u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED || u->got == NULL)
+	{
+		fail(f, ERR_CODE_MEM, "unable to allocate input buffers.");
+	}
+	u->sq_head = (unsigned*)((char*)u->sq_map + p.sq_off.head);
+	u->sq_tail = (unsigned*)((char*)u->sq_map + p.sq_off.tail);
+	u->sq_mask = (unsigned*)((char*)u->sq_map + p.sq_off.ring_mask);
+	u->sq_array = (unsigned*)((char*)u->sq_map + p.sq_off.array);
+	u->cq_head = (unsigned*)((char*)u->cq_map + p.cq_off.head);
+	u->cq_tail = (unsigned*)((char*)u->cq_map + p.cq_off.tail);
+	u->cq_mask = (unsigned*)((char*)u->cq_map + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe*)((char*)u->cq_map + p.cq_off.cqes);
+
+	//registered slots are not mapped again for every read; that needs
+	//enough locked memory, so it is only tried
+	slots = malloc(r->num_slots * sizeof(struct iovec));
+	if(slots == NULL)
+	{
+		fail(f, ERR_CODE_MEM, "unable to allocate input buffers.");
+	}
+	for(idx = 0; idx < r->num_slots; ++idx)
+	{
+		slots[idx].iov_base = r->buff[idx];
+		slots[idx].iov_len = r->slot_size;
+	}
+	u->fixed = (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, slots, (unsigned)r->num_slots) == 0);
+	free(slots);
+
+	return true;
+#else
+	(void)u; (void)path; (void)r; (void)direct; (void)f;
+	return false;
+#endif
+}
+
+//read the input into the ring, keeping a read in flight for every free slot
+static void uring_read(struct uring_reader *u, struct buffer_ring *r, struct data *d)
+{
+	size_t slots = (u->size + r->slot_size - 1) / r->slot_size;
+	size_t len;
+	double start;
+
+	while(u->published < slots && !__atomic_load_n(&d->stop, __ATOMIC_RELAXED) &&
+		  !__atomic_load_n(&r->failed, __ATOMIC_RELAXED))
+	{
+		//with nothing in flight the reader can only wait for a free slot
+		while(u->submitted < slots && ring_slot_free(r, u->submitted, u->in_flight + u->pending == 0))
+		{
+			u->got[u->submitted % r->num_slots] = 0;
+			uring_queue(u, r, u->submitted++);
+		}
+
+		if(u->in_flight + u->pending > 0)
+		{
+			start = d->stats ? now() : 0;
+			uring_reap(u, r);
+			if(d->stats)
+			{
+				d->timing.read_time += now() - start;
+			}
+		}
+
+		//slots are handed on in input order
+		while(u->published < u->submitted)
+		{
+			len = (u->size - u->published * r->slot_size < r->slot_size) ?
+				  u->size - u->published * r->slot_size : r->slot_size;
+			if(u->got[u->published % r->num_slots] < len)
+			{
+				break;
+			}
+			ring_publish(r, len);
+			u->published++;
+			__atomic_store_n(&d->timing.bytes_read, d->timing.bytes_read + len, __ATOMIC_RELAXED);
+		}
+	}
+
+	//the slots may not be reused while the kernel still writes to them
+	while(u->in_flight + u->pending > 0)
+	{
+		uring_reap(u, r);
+	}
+}
+
+//queue a read of the part of slot seq not read yet, if there is one
+static void uring_queue(struct uring_reader *u, struct buffer_ring *r, size_t seq)
+{
+#ifdef HAVE_URING
+	size_t slot = seq % r->num_slots;
+	size_t offset = seq * r->slot_size;
+	size_t len = (u->size - offset < r->slot_size) ? u->size - offset : r->slot_size;
+	unsigned tail = *u->sq_tail;
+	unsigned index = tail & *u->sq_mask;
+	struct io_uring_sqe* sqe = &u->sqes[index];
+
+	if(u->got[slot] >= len)
+	{
+		return;
+	}
+
+	//direct reads are whole blocks; the last one stops at the end of the file
+	len -= u->got[slot];
+	if(u->direct)
+	{
+		len = (len + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+	}
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = u->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = u->file;
+	sqe->off = offset + u->got[slot];
+	sqe->addr = (unsigned long)(r->buff[slot] + u->got[slot]);
+	sqe->len = len;
+	sqe->buf_index = u->fixed ? slot : 0;
+	sqe->user_data = seq;
+	u->sq_array[index] = index;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->pending++;
+#else
+	(void)u; (void)r; (void)seq;
+#endif
+}
+
+//submit the queued reads, wait for at least one of them to complete, and
+//note how much each completed read got; short reads are queued again
+static void uring_reap(struct uring_reader *u, struct buffer_ring *r)
+{
+#ifdef HAVE_URING
+	unsigned head;
+	struct io_uring_cqe* cqe;
+	size_t seq;
+	long ret;
+
+	do
+	{
+		ret = syscall(__NR_io_uring_enter, u->fd, u->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	}
+	while(ret < 0 && errno == EINTR);
+	if(ret < 0)
+	{
+		fail(u->failure, ERR_CODE_FIL, "failed reading input: %s.", strerror(errno));
+	}
+	u->in_flight += ret;
+	u->pending -= ret;
+
+	for(head = *u->cq_head; head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE); ++head)
+	{
+		cqe = &u->cqes[head & *u->cq_mask];
+		seq = cqe->user_data;
+		u->in_flight--;
+		if(cqe->res <= 0)
+		{
+			fail(u->failure, ERR_CODE_FIL, "failed reading input%s%s.",
+				 cqe->res < 0 ? ": " : "", cqe->res < 0 ? strerror(-cqe->res) : " (it got shorter)");
+		}
+		u->got[seq % r->num_slots] += cqe->res;
+		uring_queue(u, r, seq);
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+#else
+	(void)u; (void)r;
+#endif
+}
+
+static void uring_close(struct uring_reader *u)
+{
+	munmap(u->sq_map, u->sq_map_len);
+	munmap(u->cq_map, u->cq_map_len);
+	munmap(u->sqes, u->sqes_len);
+	close(u->fd);
+	close(u->file);
+	free(u->got);
+}
+
+static struct row_index* index_new(size_t every, struct failure *f)
+{
+	struct row_index* ix = malloc(sizeof(struct row_index));
+
+	if(ix == NULL)
+	{
+		fail(f, ERR_CODE_MEM, "unable to allocate the index.");
+	}
+	ix->every = every;
+	ix->offsets = NULL;
+	ix->len = 0;
+	ix->capacity = 0;
+	ix->failure = f;
+	ix->rows = 0;
+
+	return ix;
+}
+
+static void index_add(struct row_index *ix, size_t offset)
+{
+	if(ix->len == ix->capacity)
+	{
+		ix->capacity = ix->capacity ? 2 * ix->capacity : 1024;
+		ix->offsets = realloc(ix->offsets, ix->capacity * sizeof(size_t));
+		if(ix->offsets == NULL)
+		{
+			fail(ix->failure, ERR_CODE_MEM, "unable to allocate the index.");
+		}
+	}
+	ix->offsets[ix->len++] = offset;
+}
+
+//a record starts at offset; d->row records came before it
+static void index_note(struct data *d, size_t offset)
+{
+	if(d->row % d->index->every == 0)
+	{
+		index_add(d->index, offset);
+	}
+}
+
+//the record noted at offset was cut off and will be noted again
+static void index_drop(struct data *d, size_t offset)
+{
+	if(d->index->len > 0 && d->index->offsets[d->index->len - 1] == offset)
+	{
+		d->index->len--;
+	}
+}
+
+//add the record starts of a chunk whose first record comes after base others
+static void index_merge(struct row_index *dest, struct row_index *src, size_t base)
+{
+	size_t ndx;
+
+	for(ndx = 0; ndx < src->len; ++ndx)
+	{
+		if((base + ndx) % dest->every == 0)
+		{
+			index_add(dest, src->offsets[ndx]);
+		}
+	}
+}
+
+//the first indexed record start at or after offset (SIZE_MAX if none);
+//cursor remembers where the last call stopped, since offsets only grow
+static size_t index_next(struct row_index *ix, size_t *cursor, size_t offset)
+{
+	while(*cursor < ix->len && ix->offsets[*cursor] < offset)
+	{
+		++*cursor;
+	}
+
+	return (*cursor < ix->len) ? ix->offsets[*cursor] : SIZE_MAX;
+}
+
+//the index is text: a header line naming the input it was built from, then
+//one offset per line
+static void index_save(struct row_index *ix, const char *path, struct stat *st, struct data *d)
+{
+	FILE* file = fopen(path, "w");
+	size_t ndx;
+
+	if(file == NULL)
+	{
+		fail(d->failure, ERR_CODE_FIL, "File %s failed to open.", path);
+	}
+
+	fprintf(file, "%s %zu %lld %lld %d %d %zu %zu\n", INDEX_MAGIC, ix->every,
+			(long long)st->st_size, (long long)st->st_mtime,
+			(unsigned char)d->delim, (unsigned char)d->quote, ix->rows, ix->len);
+	for(ndx = 0; ndx < ix->len; ++ndx)
+	{
+		fprintf(file, "%zu\n", ix->offsets[ndx]);
+	}
+
+	if(fclose(file) != 0)
+	{
+		fail(d->failure, ERR_CODE_FIL, "failed writing %s.", path);
+	}
+}
+
+//read the index of the input described by st; NULL if there is none or it
+//was built from another version of the file or with another delimiter
+static struct row_index* index_load(const char *path, struct stat *st, struct data *d)
+{
+	FILE* file = fopen(path, "r");
+	struct row_index* ix;
+	long long size;
+	long long mtime;
+	int delim;
+	int quote;
+	size_t every;
+	size_t rows;
+	size_t len;
+	size_t offset;
+
+	if(file == NULL)
+	{
+		return NULL;
+	}
+
+	if(fscanf(file, INDEX_MAGIC " %zu %lld %lld %d %d %zu %zu",
+			  &every, &size, &mtime, &delim, &quote, &rows, &len) != 7 || every == 0)
+	{
+		fprintf(stderr, "WARNING: %s is not an index; it is not used.\n", path);
+		fclose(file);
+		return NULL;
+	}
+	if(size != (long long)st->st_size || mtime != (long long)st->st_mtime ||
+	   delim != (unsigned char)d->delim || quote != (unsigned char)d->quote)
+	{
+		fprintf(stderr, "WARNING: %s is out of date; it is not used.\n", path);
+		fclose(file);
+		return NULL;
+	}
+
+	ix = index_new(every, d->failure);
+	ix->rows = rows;
+	while(ix->len < len && fscanf(file, "%zu", &offset) == 1)
+	{
+		index_add(ix, offset);
+	}
+	fclose(file);
+
+	if(ix->len != len)
+	{
+		fprintf(stderr, "WARNING: %s is cut short; it is not used.\n", path);
+		free(ix->offsets);
+		free(ix);
+		return NULL;
+	}
+
+	return ix;
+}
+
+//parse a buffer the way libcsv would, without copying fields that do not
+//need unescaping; those reach cb2 as views into buff.  Unless final, a
+//record cut off by the end of the buffer is left for the caller to finish
+//and the number of bytes parsed is returned.
+static size_t view_parse(struct data *d, const char *buff, size_t len, int final)
+{
+	struct scan_cursor scan;
+	const char* end = buff + len;
+	const char* pos = buff;
+	const char* row_start = buff;
+	const char* field;
+	const char* stop;
+	int in_row = false;
+	char c;
+
+	scan_init(&scan, buff, len, d);
+	while(pos < end)
+	{
+		c = *pos;
+
+		//leading spaces are skipped and empty lines ignored
+		if((c == CSV_SPACE || c == CSV_TAB) && c != d->delim)
+		{
+			++pos;
+			continue;
+		}
+		if(c == CSV_CR || c == CSV_LF)
+		{
+			//a delimiter right before the end of a row leaves an empty field
+			if(in_row)
+			{
+				field_view(d, pos, 0);
+				cb2(c, d);
+				in_row = false;
+			}
+			++pos;
+			continue;
+		}
+
+		if(!in_row)
+		{
+			row_start = pos;
+			in_row = true;
+			if(d->index != NULL)
+			{
+				index_note(d, d->offset + (pos - buff));
+			}
+		}
+		if(d->current_field >= d->needed)
+		{
+			pos = record_skip(d, &scan, pos);
+		}
+		else if(c == d->quote && d->wanted != NULL && !d->wanted[d->current_field])
+		{
+			//no output uses the column, so it is never unescaped
+			pos = quoted_skip(d, &scan, pos + 1);
+			field_view(d, pos, 0);
+		}
+		else if(c == d->quote)
+		{
+			pos = quoted_view(d, &scan, pos + 1);
+		}
+		else
+		{
+			//a quote inside an unquoted field is an ordinary character
+			field = pos;
+			for(pos = scan_find(&scan, pos);
+				pos < end && *pos == d->quote;
+				pos = scan_find(&scan, pos + 1));
+
+			//trailing spaces are trimmed from unquoted fields
+			for(stop = pos; stop > field && (stop[-1] == CSV_SPACE || stop[-1] == CSV_TAB); --stop);
+			field_view(d, field, stop - field);
+		}
+
+		if(pos == end)
+		{
+			if(final)
+			{
+				cb2(-1, d);
+				in_row = false;
+			}
+			break;
+		}
+		else if(*pos == d->delim)
+		{
+			++pos;
+		}
+		else
+		{
+			cb2(*pos, d);
+			in_row = false;
+			++pos;
+		}
+	}
+
+	//drop the fields of a cut off record; it is parsed again once complete
+	if(in_row && !final)
+	{
+		if(d->index != NULL)
+		{
+			index_drop(d, d->offset + (row_start - buff));
+		}
+		d->current_field = 0;
+		d->row_len = 0;
+		if(!d->width_known)
+		{
+			d->num_fields = 0;
+		}
+		return row_start - buff;
+	}
+
+	//the input ended right after a delimiter
+	if(in_row)
+	{
+		field_view(d, end, 0);
+		cb2(-1, d);
+	}
+
+	return len;
+}
+
+//a quoted field whose closing quote is followed only by spaces and then a
+//delimiter, newline or the end of the input is a view of its contents;
+//returns the position of the byte that ended the field
+static const char* quoted_view(struct data *d, struct scan_cursor *scan, const char *pos)
+{
+	const char* end = scan->end;
+	const char* quote;
+	const char* after;
+
+	for(quote = scan_find(scan, pos);
+		quote < end && *quote != d->quote;
+		quote = scan_find(scan, quote + 1));
+
+	//unterminated quotes run to the end of the input
+	if(quote == end)
+	{
+		field_view(d, pos, end - pos);
+		return end;
+	}
+
+	for(after = quote + 1;
+		after < end && (*after == CSV_SPACE || *after == CSV_TAB) && *after != d->delim;
+		++after);
+	if(after == end || *after == d->delim || *after == CSV_CR || *after == CSV_LF)
+	{
+		field_view(d, pos, quote - pos);
+		return after;
+	}
+
+	return quoted_copy(d, pos, end);
+}
+
+//copy a quoted field that needs unescaping into the row buffer,
+//following libcsv's FIELD_BEGUN/FIELD_MIGHT_HAVE_ENDED rules
+static const char* quoted_copy(struct data *d, const char *pos, const char *end)
+{
+	size_t first = d->row_len;
+	size_t spaces = 0;
+	int might_end = false;
+	char c;
+
+	for(; pos < end; ++pos)
+	{
+		c = *pos;
+		if(might_end)
+		{
+			if(c == d->delim || c == CSV_CR || c == CSV_LF)
+			{
+				break;
+			}
+			else if(c == CSV_SPACE || c == CSV_TAB)
+			{
+				spaces++;
+			}
+			else if(c == d->quote && spaces == 0)
+			{
+				//two quotes in a row: the first one is kept
+				might_end = false;
+				continue;
+			}
+			else
+			{
+				//a quote after spaces keeps the field open to ending
+				might_end = (c == d->quote);
+				spaces = 0;
+			}
+		}
+		else if(c == d->quote)
+		{
+			might_end = true;
+		}
+
+		if(d->row_len == d->row_capacity)
+		{
+			rowGrow(d, 1);
+		}
+		d->row_buff[d->row_len++] = c;
+	}
+
+	//drop the closing quote and any spaces after it
+	if(might_end)
+	{
+		d->row_len -= spaces + 1;
+	}
+
+	if(d->row_buff == NULL)
+	{
+		rowGrow(d, 0);
+	}
+	field_view(d, d->row_buff + first, d->row_len - first);
+	return pos;
+}
+
+//find the end of a quoted field without copying it; returns the position
+//of the byte that ended the field, as quoted_copy does
+static const char* quoted_skip(struct data *d, struct scan_cursor *scan, const char *pos)
+{
+	const char* end = scan->end;
+	const char* after;
+
+	for(;;)
+	{
+		for(pos = scan_find(scan, pos);
+			pos < end && *pos != d->quote;
+			pos = scan_find(scan, pos + 1));
+		if(pos == end)
+		{
+			return end;
+		}
+
+		for(after = pos + 1;
+			after < end && (*after == CSV_SPACE || *after == CSV_TAB) && *after != d->delim;
+			++after);
+		if(after == end || *after == d->delim || *after == CSV_CR || *after == CSV_LF)
+		{
+			return after;
+		}
+
+		if(after == pos + 1 && *after == d->quote)
+		{
+			//two quotes in a row
+			pos = after + 1;
+		}
+		else
+		{
+			//a quote after spaces may end the field itself
+			pos = (*after == d->quote) ? after : after + 1;
+		}
+	}
+}
+
+//skip the fields of a row that come after the last column any output uses,
+//starting at the first of them; returns the position of the newline that
+//ends the row (or the end).  Only quotes and newlines are looked at, since
+//delimiters no longer matter.
+static const char* record_skip(struct data *d, struct scan_cursor *scan, const char *pos)
+{
+	struct scan_cursor lines;
+	const char* end = scan->end;
+	const char* first = pos;
+	const char* back;
+
+	lines.end = end;
+	lines.delim = d->quote;
+	lines.quote = d->quote;
+	scan_load(&lines, pos);
+
+	for(;;)
+	{
+		pos = scan_find(&lines, pos);
+		if(pos == end || *pos != d->quote)
+		{
+			return pos;
+		}
+
+		//a quote opens a quoted field only where a field starts
+		for(back = pos;
+			back > first && (back[-1] == CSV_SPACE || back[-1] == CSV_TAB) && back[-1] != d->delim;
+			--back);
+		if(back == first || back[-1] == d->delim)
+		{
+			pos = quoted_skip(d, &lines, pos + 1);
+			if(pos == end || *pos != d->delim)
+			{
+				return pos;
+			}
+		}
+		++pos;
+	}
+}
+
+//add the next field of the row
+static void field_view(struct data *d, const char *c, size_t n)
+{
+	if(d->current_field >= d->field_slots)
+	{
+		fieldGrow(d);
+	}
+
+	if(!d->width_known)
+	{
+		d->num_fields++;
+	}
+
+	d->view[d->current_field] = c;
+	d->field_lengths[d->current_field] = n;
+	d->current_field++;
+}
+
+static void fieldGrow(struct data *d)
+{
+	size_t ndx;
+	size_t slots = d->field_slots ? 2 * d->field_slots : 16;
+
+	while(slots <= d->current_field)
+	{
+		slots *= 2;
+	}
+
+	d->view = realloc(d->view, slots * sizeof(char*));
+	d->field_lengths = realloc(d->field_lengths, slots * sizeof(size_t));
+	if(d->view == NULL || d->field_lengths == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+	}
+
+	for(ndx = d->field_slots; ndx < slots; ++ndx)
+	{
+		d->view[ndx] = NULL;
+		d->field_lengths[ndx] = 0;
+	}
+	d->field_slots = slots;
+}
+
+//make room for n more bytes in the row buffer; fields of the current row
+//that were copied into it move with it.  The old buffer stays in the
+//arena until the batch is written.
+static void rowGrow(struct data *d, size_t n)
+{
+	size_t ndx;
+	size_t capacity = (d->row_capacity < 2048) ? 4096 : 2 * d->row_capacity;
+	char* buff;
+
+	while(capacity < d->row_len + n)
+	{
+		capacity *= 2;
+	}
+
+	buff = arena_alloc(&d->arena, capacity);
+	if(d->row_len > 0)
+	{
+		memcpy(buff, d->row_buff, d->row_len);
+	}
+
+	for(ndx = 0; ndx < d->current_field; ++ndx)
+	{
+		if(d->view[ndx] >= d->row_buff && d->view[ndx] < d->row_buff + d->row_len)
+		{
+			d->view[ndx] = buff + (d->view[ndx] - d->row_buff);
+		}
+	}
+
+	//a buffer with a block of its own holds only this row
+	if(d->row_buff != NULL)
+	{
+		arena_release(&d->arena, d->row_buff);
+	}
+	d->row_buff = buff;
+	d->row_capacity = capacity;
+}
+
+static void arena_init(struct arena *a, struct failure *f)
+{
+	a->failure = f;
+	a->blocks = NULL;
+	a->spare = NULL;
+	a->num_spare = 0;
+	a->next = NULL;
+	a->end = NULL;
+	a->held = 0;
+	a->peak = 0;
+}
+
+//take n bytes from the arena
+static char* arena_alloc(struct arena *a, size_t n)
+{
+	char* p = a->next;
+
+	if(n > (size_t)(a->end - p))
+	{
+		return arena_grow(a, n);
+	}
+	a->next = p + n;
+
+	return p;
+}
+
+//take n bytes that do not fit in the current block from a new one; a
+//spare block is reused when there is one
+static char* arena_grow(struct arena *a, size_t n)
+{
+	struct arena_block* block;
+	size_t size = (n > ARENA_BLOCK / 4) ? n : ARENA_BLOCK;
+
+	if(size == ARENA_BLOCK && a->spare != NULL)
+	{
+		block = a->spare;
+		a->spare = block->next;
+		a->num_spare--;
+	}
+	else
+	{
+		block = malloc(sizeof(struct arena_block) + size);
+		if(block == NULL)
+		{
+			fail(a->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+		}
+		block->size = size;
+	}
+
+	a->held += size;
+	if(a->held > a->peak)
+	{
+		a->peak = a->held;
+	}
+
+	//a block of its own goes behind the current one, which keeps its space
+	if(size != ARENA_BLOCK && a->blocks != NULL)
+	{
+		block->next = a->blocks->next;
+		a->blocks->next = block;
+		return block->data;
+	}
+
+	block->next = a->blocks;
+	a->blocks = block;
+	a->next = block->data + n;
+	a->end = block->data + size;
+
+	return block->data;
+}
+
+//free the block of its own that p starts, if it has one
+static void arena_release(struct arena *a, char *p)
+{
+	struct arena_block** link;
+	struct arena_block* block;
+
+	for(link = &a->blocks; *link != NULL; link = &(*link)->next)
+	{
+		block = *link;
+		if(block->data == p && block->size != ARENA_BLOCK)
+		{
+			if(block == a->blocks)
+			{
+				a->next = NULL;
+				a->end = NULL;
+			}
+			*link = block->next;
+			a->held -= block->size;
+			free(block);
+			return;
+		}
+	}
+}
+
+//give back everything taken from the arena; up to ARENA_KEEP blocks are
+//kept for reuse and the rest, including every oversized one, are freed
+static void arena_reset(struct arena *a)
+{
+	struct arena_block* block;
+
+	while(a->blocks != NULL)
+	{
+		block = a->blocks;
+		a->blocks = block->next;
+		if(block->size == ARENA_BLOCK && a->num_spare < ARENA_KEEP)
+		{
+			block->next = a->spare;
+			a->spare = block;
+			a->num_spare++;
+		}
+		else
+		{
+			free(block);
+		}
+	}
+
+	a->next = NULL;
+	a->end = NULL;
+	a->held = 0;
+}
+
+static void arena_free(struct arena *a)
+{
+	struct arena_block* block;
+
+	arena_reset(a);
+	while(a->spare != NULL)
+	{
+		block = a->spare;
+		a->spare = block->next;
+		free(block);
+	}
+	a->num_spare = 0;
+}
+
+static void stream_init(struct view_stream *s, struct data *d)
+{
+	s->carry = NULL;
+	s->len = 0;
+	s->capacity = 0;
+	s->state = ST_ROW;
+	s->offset = 0;
+	s->carry_offset = 0;
+	s->failure = d->failure;
+	scan_table(s->table, d->delim, d->quote);
+}
+
+//parse the next buffer of an input, carrying a record cut off at its end
+//over to the buffer after it
+static void stream_parse(struct view_stream *s, const char *buff, size_t len, struct data *d)
+{
+	const unsigned char* ubuff = (const unsigned char*)buff;
+	size_t used = 0;
+	size_t ndx;
+
+	//the carried record ends where the boundary scan gets back between rows
+	if(s->len > 0)
+	{
+		while(used < len && s->state != ST_ROW)
+		{
+			s->state = s->table[s->state][ubuff[used++]];
+		}
+		stream_carry(s, buff, used);
+		if(s->state != ST_ROW)
+		{
+			s->offset += len;
+			return;
+		}
+		d->offset = s->carry_offset;
+		view_parse(d, s->carry, s->len, true);
+		s->len = 0;
+	}
+
+	d->offset = s->offset + used;
+	used += view_parse(d, buff + used, len - used, false);
+	if(used < len)
+	{
+		s->carry_offset = s->offset + used;
+		stream_carry(s, buff + used, len - used);
+		s->state = ST_ROW;
+		for(ndx = 0; ndx < s->len; ++ndx)
+		{
+			s->state = s->table[s->state][(unsigned char)s->carry[ndx]];
+		}
+	}
+	s->offset += len;
+}
+
+static void stream_carry(struct view_stream *s, const char *buff, size_t len)
+{
+	if(s->len + len > s->capacity)
+	{
+		s->capacity = s->capacity ? 2 * s->capacity : 4096;
+		while(s->capacity < s->len + len)
+		{
+			s->capacity *= 2;
+		}
+		s->carry = realloc(s->carry, s->capacity);
+		if(s->carry == NULL)
+		{
+			fail(s->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+		}
+	}
+	if(len > 0)
+	{
+		memcpy(s->carry + s->len, buff, len);
+		s->len += len;
+	}
+}
+
+//parse what is left once the input has ended
+static void stream_fini(struct view_stream *s, struct data *d)
+{
+	if(s->len > 0)
+	{
+		d->offset = s->carry_offset;
+		view_parse(d, s->carry, s->len, true);
+		s->len = 0;
+	}
+}
+
+static void stream_free(struct view_stream *s)
+{
+	free(s->carry);
+	s->carry = NULL;
+	s->capacity = 0;
+}
+
+//bit i is set where p[i] is the delimiter, the quote, CR or LF
+static uint64_t classify_tail(const char *p, size_t n, char delim, char quote)
+{
+	uint64_t bits = 0;
+	size_t ndx;
+
+	for(ndx = 0; ndx < n; ++ndx)
+	{
+		if(p[ndx] == delim || p[ndx] == quote || p[ndx] == CSV_CR || p[ndx] == CSV_LF)
+		{
+			bits |= (uint64_t)1 << ndx;
+		}
+	}
+
+	return bits;
+}
+
+static uint64_t classify64_scalar(const char *p, char delim, char quote)
+{
+	return classify_tail(p, 64, delim, quote);
+}
+
+#ifdef SCAN_X86
+static uint64_t classify64_sse2(const char *p, char delim, char quote)
+{
+	const __m128i vd = _mm_set1_epi8(delim);
+	const __m128i vq = _mm_set1_epi8(quote);
+	const __m128i vcr = _mm_set1_epi8(CSV_CR);
+	const __m128i vlf = _mm_set1_epi8(CSV_LF);
+	uint64_t bits = 0;
+	__m128i v;
+	int ndx;
+
+	for(ndx = 3; ndx >= 0; --ndx)
+	{
+		v = _mm_loadu_si128((const __m128i*)(p + 16 * ndx));
+		v = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, vd), _mm_cmpeq_epi8(v, vq)),
+						 _mm_or_si128(_mm_cmpeq_epi8(v, vcr), _mm_cmpeq_epi8(v, vlf)));
+		bits = (bits << 16) | (uint16_t)_mm_movemask_epi8(v);
+	}
+
+	return bits;
+}
+
+static __attribute__((target("avx2")))
+uint64_t classify64_avx2(const char *p, char delim, char quote)
+{
+	const __m256i vd = _mm256_set1_epi8(delim);
+	const __m256i vq = _mm256_set1_epi8(quote);
+	const __m256i vcr = _mm256_set1_epi8(CSV_CR);
+	const __m256i vlf = _mm256_set1_epi8(CSV_LF);
+	__m256i lo = _mm256_loadu_si256((const __m256i*)p);
+	__m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+
+	lo = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lo, vd), _mm256_cmpeq_epi8(lo, vq)),
+						 _mm256_or_si256(_mm256_cmpeq_epi8(lo, vcr), _mm256_cmpeq_epi8(lo, vlf)));
+	hi = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(hi, vd), _mm256_cmpeq_epi8(hi, vq)),
+						 _mm256_or_si256(_mm256_cmpeq_epi8(hi, vcr), _mm256_cmpeq_epi8(hi, vlf)));
+
+	return ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32) |
+		   (uint32_t)_mm256_movemask_epi8(lo);
+}
+
+static __attribute__((target("avx512bw")))
+uint64_t classify64_avx512(const char *p, char delim, char quote)
+{
+	__m512i v = _mm512_loadu_si512((const void*)p);
+
+	return _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(delim)) |
+		   _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(quote)) |
+		   _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(CSV_CR)) |
+		   _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(CSV_LF));
+}
+#endif
+
+//pick the widest classifier the processor supports
+static void scan_select(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512bw"))
+	{
+		classify64 = classify64_avx512;
+	}
+	else if(__builtin_cpu_supports("avx2"))
+	{
+		classify64 = classify64_avx2;
+	}
+	else
+	{
+		classify64 = classify64_sse2;
+	}
+#endif
+}
+
+static void scan_init(struct scan_cursor *s, const char *buff, size_t len, struct data *d)
+{
+	s->end = buff + len;
+	s->delim = d->delim;
+	s->quote = d->quote;
+	scan_load(s, buff);
+}
+
+//classify the block starting at pos
+static void scan_load(struct scan_cursor *s, const char *pos)
+{
+	s->block = pos;
+	s->bits = (s->end - pos >= 64) ? classify64(pos, s->delim, s->quote)
+								   : classify_tail(pos, s->end - pos, s->delim, s->quote);
+}
+
+//the first delimiter, quote, CR or LF at or after pos (end if there is none);
+//positions asked for never go backwards
+static const char* scan_find(struct scan_cursor *s, const char *pos)
+{
+	uint64_t bits;
+
+	while(pos < s->end)
+	{
+		if(pos - s->block >= 64)
+		{
+			scan_load(s, pos);
+		}
+
+		bits = s->bits & (~(uint64_t)0 << (pos - s->block));
+		if(bits != 0)
+		{
+			return s->block + __builtin_ctzll(bits);
+		}
+		pos = s->block + 64;
+	}
+
+	return s->end;
+}
+
+static size_t sizeAssign(char *optarg, const char *name, struct failure *f)
+{
+	char *end;
+	unsigned long long value = strtoull(optarg, &end, 10);
+
+	//optional binary suffix
+	switch(toupper((unsigned char)*end))
+	{
+		case 'K': value <<= 10; ++end; break;
+		case 'M': value <<= 20; ++end; break;
+		case 'G': value <<= 30; ++end; break;
+	}
+
+	//strtoull() would take a minus sign and wrap the value around
+	if(end == optarg || *end != '\0' || value == 0 || strchr(optarg, '-') != NULL)
+	{
+		fail(f, ERR_CODE_OPT, "invalid value %s for --%s.", optarg, name);
+	}
+
+	return (size_t)value;
+}
+
+static void ring_init(struct buffer_ring *r, size_t num_slots, size_t slot_size, int views, struct failure *f)
+{
+	size_t idx;
+
+	r->buff = calloc(num_slots, sizeof(char*));
+	r->size = calloc(num_slots, sizeof(size_t));
+	r->offset = calloc(num_slots, sizeof(size_t));
+	if(r->buff == NULL || r->size == NULL || r->offset == NULL)
+	{
+		fail(f, ERR_CODE_MEM, "unable to allocate input buffers.");
+	}
+
+	//slots are aligned for --io-uring=direct
+	for(idx = 0; idx < num_slots && !views; ++idx)
+	{
+		if(posix_memalign((void**)&r->buff[idx], DIRECT_ALIGN, slot_size) != 0)
+		{
+			fail(f, ERR_CODE_MEM, "unable to allocate input buffers.");
+		}
+	}
+
+	r->num_slots = num_slots;
+	r->slot_size = slot_size;
+	r->filled = 0;
+	r->bytes = 0;
+	r->claimed = 0;
+	r->released = 0;
+	r->done = false;
+	r->failed = false;
+	r->full_waits = 0;
+	r->empty_waits = 0;
+	r->views = views;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->not_empty, NULL);
+	pthread_cond_init(&r->not_full, NULL);
+}
+
+//wait for a free slot and return its index, or -1 once the job has failed;
+//only the reader calls this
+static long ring_acquire_empty(struct buffer_ring *r)
+{
+	long idx;
+
+	pthread_mutex_lock(&r->lock);
+	if(r->filled - r->released == r->num_slots)
+	{
+		r->full_waits++;
+	}
+	while(r->filled - r->released == r->num_slots && !r->failed)
+	{
+		pthread_cond_wait(&r->not_full, &r->lock);
+	}
+	idx = r->failed ? -1 : (long)(r->filled % r->num_slots);
+	pthread_mutex_unlock(&r->lock);
+
+	return idx;
+}
+
+//hand the slot returned by ring_acquire_empty to the parser(s)
+static void ring_publish(struct buffer_ring *r, size_t len)
+{
+	pthread_mutex_lock(&r->lock);
+	r->size[r->filled % r->num_slots] = len;
+	r->offset[r->filled % r->num_slots] = r->bytes;
+	r->bytes += len;
+	r->filled++;
+	pthread_cond_broadcast(&r->not_empty);
+	pthread_mutex_unlock(&r->lock);
+}
+
+//no more slots will be published
+static void ring_finish(struct buffer_ring *r)
+{
+	pthread_mutex_lock(&r->lock);
+	r->done = true;
+	pthread_cond_broadcast(&r->not_empty);
+	pthread_mutex_unlock(&r->lock);
+}
+
+//a thread of the job has failed: wake every thread waiting on the ring, and
+//have it wait no more
+static void ring_abort(struct buffer_ring *r)
+{
+	pthread_mutex_lock(&r->lock);
+	r->done = true;
+	r->failed = true;
+	pthread_cond_broadcast(&r->not_empty);
+	pthread_cond_broadcast(&r->not_full);
+	pthread_mutex_unlock(&r->lock);
+}
+
+//wait for a filled slot and return its sequence number, or -1 once drained
+//or failed
+static long ring_acquire_full(struct buffer_ring *r)
+{
+	long seq = -1;
+
+	pthread_mutex_lock(&r->lock);
+	if(r->claimed == r->filled && !r->done)
+	{
+		r->empty_waits++;
+	}
+	while(r->claimed == r->filled && !r->done)
+	{
+		pthread_cond_wait(&r->not_empty, &r->lock);
+	}
+	if(r->claimed < r->filled && !r->failed)
+	{
+		seq = r->claimed++;
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return seq;
+}
+
+//wait until slot seq has been filled; false if input ended before it
+static int ring_has_slot(struct buffer_ring *r, size_t seq)
+{
+	int found;
+
+	pthread_mutex_lock(&r->lock);
+	if(seq >= r->filled && !r->done)
+	{
+		r->empty_waits++;
+	}
+	while(seq >= r->filled && !r->done)
+	{
+		pthread_cond_wait(&r->not_empty, &r->lock);
+	}
+	found = (seq < r->filled && !r->failed);
+	pthread_mutex_unlock(&r->lock);
+
+	return found;
+}
+
+//whether slot seq can be filled (every slot before it has been, and the
+//one it reuses has been released), waiting until it can if wait is set
+static int ring_slot_free(struct buffer_ring *r, size_t seq, int wait)
+{
+	int found;
+
+	pthread_mutex_lock(&r->lock);
+	if(wait && seq - r->released >= r->num_slots)
+	{
+		r->full_waits++;
+	}
+	while(wait && seq - r->released >= r->num_slots && !r->failed)
+	{
+		pthread_cond_wait(&r->not_full, &r->lock);
+	}
+	found = (seq - r->released < r->num_slots && !r->failed);
+	pthread_mutex_unlock(&r->lock);
+
+	return found;
+}
+
+//give the oldest unreleased slot back to the reader
+static void ring_release(struct buffer_ring *r)
+{
+	pthread_mutex_lock(&r->lock);
+	r->released++;
+	pthread_cond_signal(&r->not_full);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void ring_free(struct buffer_ring *r)
+{
+	size_t idx;
+
+	for(idx = 0; idx < r->num_slots && !r->views; ++idx)
+	{
+		free(r->buff[idx]);
+	}
+	free(r->buff);
+	free(r->size);
+	free(r->offset);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->not_empty);
+	pthread_cond_destroy(&r->not_full);
+}
+
+static void parallel_init(struct parallel_scan *ps, struct buffer_ring *r, struct data *d)
+{
+	size_t ndx;
+
+	ps->ring = r;
+	ps->dat = d;
+	ps->contiguous = false;
+	ps->aligned = false;
+	ps->start = malloc(r->num_slots * sizeof(long));
+	ps->first = malloc(r->num_slots * sizeof(*ps->first));
+	ps->last = malloc(r->num_slots * sizeof(*ps->last));
+	ps->scanned = malloc(r->num_slots * sizeof(short));
+	ps->parts = malloc(r->num_slots * sizeof(short));
+	if(ps->start == NULL || ps->first == NULL || ps->last == NULL || ps->scanned == NULL || ps->parts == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate thread data.");
+	}
+	for(ndx = 0; ndx < r->num_slots; ++ndx)
+	{
+		ps->start[ndx] = START_UNKNOWN;
+		ps->scanned[ndx] = false;
+		ps->parts[ndx] = 0;
+	}
+	ps->resolved = 0;
+	ps->entry = ST_ROW;
+
+	ps->next_commit = 0;
+	ps->num_fields = 0;
+	ps->width_known = false;
+	ps->contiguous = false;
+
+	scan_table(ps->table, d->delim, d->quote);
+
+	pthread_mutex_init(&ps->lock, NULL);
+	pthread_cond_init(&ps->changed, NULL);
+}
+
+static void parallel_thread_init(struct parallel_thread *t, struct parallel_scan *ps)
+{
+	t->ps = ps;
+	t->staged = stage_init(&t->dat, ps->dat, &t->num_staged);
+
+	//a thread keeps every record start of its chunk; the commit picks the
+	//ones the index wants once the chunk's first record number is known
+	if(ps->dat->index != NULL)
+	{
+		t->dat.index = index_new(1, t->dat.failure);
+	}
+
+	stream_init(&t->stream, &t->dat);
+}
+
+//set up copy as a private parser for a thread, writing to memory that
+//stands in for each of d's outputs; returns that memory, num_staged long
+static struct staged_output* stage_init(struct data *copy, struct data *d, size_t *num_staged)
+{
+	struct staged_output* staged;
+	struct output_file* output;
+	size_t ndx;
+	size_t other;
+	size_t part;
+
+	*copy = *d;
+	copy->view = NULL;
+	copy->field_lengths = NULL;
+	arena_init(&copy->arena, copy->failure);
+	copy->row_buff = NULL;
+	copy->row_len = 0;
+	copy->row_capacity = 0;
+	copy->batch = NULL;
+	copy->field_slots = 0;
+	copy->current_field = 0;
+	copy->index = NULL;
+	memset(&copy->timing, 0, sizeof(copy->timing));
+
+	//one memory stream per real output, linked like the real list
+	*num_staged = 0;
+	for(output = d->outputs; output != NULL; output = output->next)
+	{
+		(*num_staged)++;
+	}
+	staged = malloc(*num_staged * sizeof(struct staged_output));
+	if(staged == NULL)
+	{
+		fail(d->failure, ERR_CODE_MEM, "unable to allocate thread data.");
+	}
+
+	for(ndx = 0, output = d->outputs; output != NULL; ++ndx, output = output->next)
+	{
+		staged[ndx].out = *output;
+		staged[ndx].dest = output;
+		sink_init(&staged[ndx].sink, -1, CODEC_NONE, copy->failure);
+
+		//a partitioned output writes each partition to memory of its own
+		staged[ndx].parts = NULL;
+		if(output->num_parts > 0)
+		{
+			staged[ndx].parts = malloc(output->num_parts * sizeof(struct out_buffer));
+			if(staged[ndx].parts == NULL)
+			{
+				fail(d->failure, ERR_CODE_MEM, "unable to allocate thread data.");
+			}
+			for(part = 0; part < output->num_parts; ++part)
+			{
+				sink_init(&staged[ndx].parts[part], -1, CODEC_NONE, copy->failure);
+			}
+			staged[ndx].out.parts = staged[ndx].parts;
+			staged[ndx].out.sink = &staged[ndx].parts[0];
+			staged[ndx].out.next = (ndx + 1 < *num_staged) ? &staged[ndx + 1].out : NULL;
+			continue;
+		}
+
+		//staged outputs share memory where the real ones share a file
+		for(other = 0; other < ndx && staged[other].dest->sink != output->sink; ++other);
+		staged[ndx].out.sink = (other < ndx) ? staged[other].out.sink : &staged[ndx].sink;
+		staged[ndx].out.next = (ndx + 1 < *num_staged) ? &staged[ndx + 1].out : NULL;
+	}
+	copy->outputs = *num_staged ? &staged[0].out : NULL;
+
+	return staged;
+}
+
+//hand the rows staged so far to the real outputs
+static void stage_commit(struct staged_output *staged, size_t num_staged)
+{
+	size_t ndx;
+	size_t part;
+
+	for(ndx = 0; ndx < num_staged; ++ndx)
+	{
+		if(staged[ndx].out.sink == &staged[ndx].sink)
+		{
+			out_commit(staged[ndx].dest->sink, &staged[ndx].sink);
+		}
+		for(part = 0; part < staged[ndx].out.num_parts; ++part)
+		{
+			if(staged[ndx].parts[part].len > 0)
+			{
+				out_commit(&staged[ndx].dest->parts[part], &staged[ndx].parts[part]);
+			}
+		}
+	}
+}
+
+//free what stage_init() set up
+static void stage_free(struct staged_output *staged, size_t num_staged)
+{
+	size_t ndx;
+	size_t part;
+
+	for(ndx = 0; ndx < num_staged; ++ndx)
+	{
+		free(staged[ndx].sink.buff);
+		for(part = 0; staged[ndx].parts != NULL && part < staged[ndx].dest->num_parts; ++part)
+		{
+			free(staged[ndx].parts[part].buff);
+		}
+		free(staged[ndx].parts);
+	}
+	free(staged);
+}
+
+static void scan_table(unsigned char table[NUM_STATES][256], unsigned char delim, unsigned char quote)
+{
+	int state;
+	int c;
+
+	for(state = 0; state < NUM_STATES; ++state)
+	{
+		for(c = 0; c < 256; ++c)
+		{
+			table[state][c] = scan_next(state, c, delim, quote);
+		}
+	}
+}
+
+//one step of the libcsv state machine, reduced to the states that decide
+//where fields and rows end (see csv_parse in libcsv)
+static unsigned char scan_next(int state, unsigned char c, unsigned char delim, unsigned char quote)
+{
+	int space = (c == CSV_SPACE || c == CSV_TAB);
+	int term = (c == CSV_CR || c == CSV_LF);
+
+	switch(state)
+	{
+		case ST_ROW:
+		case ST_FIELD:
+			if(space && c != delim)
+			{
+				return state;
+			}
+			if(term)
+			{
+				return ST_ROW;
+			}
+			if(c == delim)
+			{
+				return ST_FIELD;
+			}
+			return (c == quote) ? ST_QUOTED : ST_UNQUOTED;
+
+		case ST_UNQUOTED:
+			if(c == quote)
+			{
+				return ST_UNQUOTED;
+			}
+			if(c == delim)
+			{
+				return ST_FIELD;
+			}
+			return term ? ST_ROW : ST_UNQUOTED;
+
+		case ST_QUOTED:
+			return (c == quote) ? ST_END : ST_QUOTED;
+
+		default:
+			if(c == delim)
+			{
+				return ST_FIELD;
+			}
+			if(term)
+			{
+				return ST_ROW;
+			}
+			if(space)
+			{
+				return ST_END_SP;
+			}
+			//a quote after spaces is kept and the field may still end
+			if(c == quote && state == ST_END_SP)
+			{
+				return ST_END;
+			}
+			return ST_QUOTED;
+	}
+}
+
+//follow every state a slot may start in through all of it, noting for each
+//where the first record starts and the state the slot ends in
+//
+//The parser state at the start of a slot depends on everything before it,
+//so the scan runs every possible state side by side.  States that agree go
+//on as one, which soon leaves one on input with quotes; input without them
+//always keeps two, as a quoted field only ends at a quote.  Which of them
+//was right is settled once the slot before is (see parallel_resolve).
+//Only quotes can part the states again, so the scan goes from one to the
+//next, each state taking the stretch between them in one step (scan_run).
+static void scan_slot(unsigned char table[NUM_STATES][256], unsigned char delim, unsigned char quote,
+			   const char *buff, size_t len, long first[NUM_STATES], unsigned char last[NUM_STATES])
+{
+	const unsigned char* ubuff = (const unsigned char*)buff;
+	const unsigned char* next_quote;
+	unsigned char state[NUM_STATES];	//state of each guess still apart
+	unsigned char starts[NUM_STATES];	//states the guess started from
+	unsigned char waiting[NUM_STATES];	//those of them with no record start yet
+	size_t num_states = NUM_STATES;
+	size_t pos = 0;
+	size_t end;
+	size_t ndx;
+	size_t other;
+	long row;
+	int bit;
+
+	for(ndx = 0; ndx < NUM_STATES; ++ndx)
+	{
+		state[ndx] = ndx;
+		starts[ndx] = 1 << ndx;
+		waiting[ndx] = 1 << ndx;
+		first[ndx] = START_NONE;
+	}
+
+	while(pos < len)
+	{
+		next_quote = memchr(ubuff + pos, quote, len - pos);
+		end = (next_quote == NULL) ? len : (size_t)(next_quote - ubuff) + 1;
+
+		for(ndx = 0; ndx < num_states; ++ndx)
+		{
+			row = START_NONE;
+			state[ndx] = scan_run(table, delim, ubuff, pos, end, state[ndx], waiting[ndx] ? &row : NULL);
+			for(bit = 0; row != START_NONE && bit < NUM_STATES; ++bit)
+			{
+				if(waiting[ndx] & (1 << bit))
+				{
+					first[bit] = row;
+				}
+			}
+			waiting[ndx] = (row != START_NONE) ? 0 : waiting[ndx];
+		}
+		pos = end;
+
+		//merge guesses that agree
+		for(ndx = 1; ndx < num_states; )
+		{
+			for(other = 0; other < ndx && state[other] != state[ndx]; ++other);
+			if(other < ndx)
+			{
+				starts[other] |= starts[ndx];
+				waiting[other] |= waiting[ndx];
+				--num_states;
+				state[ndx] = state[num_states];
+				starts[ndx] = starts[num_states];
+				waiting[ndx] = waiting[num_states];
+			}
+			else
+			{
+				++ndx;
+			}
+		}
+	}
+
+	for(ndx = 0; ndx < num_states; ++ndx)
+	{
+		for(bit = 0; bit < NUM_STATES; ++bit)
+		{
+			if(starts[ndx] & (1 << bit))
+			{
+				last[bit] = state[ndx];
+			}
+		}
+	}
+}
+
+//run state over ubuff[pos, end), where only the last byte may be a quote,
+//and return the state at the end.  Unless row is NULL, it is set to where
+//a record first starts in the stretch.
+static unsigned char scan_run(unsigned char table[NUM_STATES][256], unsigned char delim,
+					   const unsigned char *ubuff, size_t pos, size_t end, unsigned char state, long *row)
+{
+	size_t back;
+
+	//a quoted field goes on to the quote, and the states after one take a
+	//byte or two to settle; a record start is never far off either
+	while(pos < end && state != ST_QUOTED && (state == ST_END || state == ST_END_SP || row != NULL))
+	{
+		state = table[state][ubuff[pos++]];
+		if(state == ST_ROW && row != NULL)
+		{
+			*row = pos;
+			row = NULL;
+		}
+	}
+	if(state == ST_QUOTED)
+	{
+		return (end > pos) ? table[state][ubuff[end - 1]] : state;
+	}
+	if(pos == end)
+	{
+		return state;
+	}
+
+	//outside quotes the state only follows the last byte that is not a
+	//space, and the quote that may end the stretch is stepped on its own
+	for(back = end - 1; back > pos; --back)
+	{
+		if(ubuff[back - 1] == delim)
+		{
+			state = ST_FIELD;
+			break;
+		}
+		if(ubuff[back - 1] == CSV_CR || ubuff[back - 1] == CSV_LF)
+		{
+			state = ST_ROW;
+			break;
+		}
+		if(ubuff[back - 1] != CSV_SPACE && ubuff[back - 1] != CSV_TAB)
+		{
+			state = ST_UNQUOTED;
+			break;
+		}
+	}
+
+	return table[state][ubuff[end - 1]];
+}
+
+//settle the record start of each scanned slot in turn: the state a slot
+//starts in is the one the slot before ended in, and the first starts in
+//a record.  Called with ps->lock held.
+static void parallel_resolve(struct parallel_scan *ps)
+{
+	struct buffer_ring* r = ps->ring;
+	size_t slot;
+
+	while(ps->scanned[ps->resolved % r->num_slots])
+	{
+		slot = ps->resolved % r->num_slots;
+		ps->start[slot] = (ps->resolved == 0) ? 0 : ps->first[slot][ps->entry];
+		ps->entry = ps->last[slot][ps->entry];
+		ps->scanned[slot] = false;
+		ps->resolved++;
+	}
+}
+
+//record parsed halves of a slot and release every finished slot at the tail;
+//the half before the first record start is parsed by the previous chunk
+static void parallel_mark(struct parallel_scan *ps, size_t seq, short parts)
+{
+	struct buffer_ring* r = ps->ring;
+	size_t slot;
+
+	pthread_mutex_lock(&ps->lock);
+	ps->parts[seq % r->num_slots] += parts;
+	while(ps->parts[r->released % r->num_slots] == 2)
+	{
+		slot = r->released % r->num_slots;
+		ps->start[slot] = START_UNKNOWN;
+		ps->parts[slot] = 0;
+		ring_release(r);
+	}
+	pthread_mutex_unlock(&ps->lock);
+}
+
+//parse part of a chunk, publishing the column count as soon as it is known
+static void parallel_parse(struct parallel_thread *t, char *buff, size_t len)
+{
+	size_t piece;
+	double start = t->dat.stats ? now() : 0;
+
+	while(len > 0)
+	{
+		piece = (!t->dat.width_known && len > WIDTH_PIECE) ? WIDTH_PIECE : len;
+		stream_parse(&t->stream, buff, piece, &t->dat);
+		buff += piece;
+		len -= piece;
+		parallel_width(t);
+	}
+
+	if(t->dat.stats)
+	{
+		t->dat.timing.parse_time += now() - start;
+	}
+}
+
+//publish the column count once this thread has parsed the first row
+static void parallel_width(struct parallel_thread *t)
+{
+	struct parallel_scan* ps = t->ps;
+
+	if(t->dat.width_known && !ps->width_known)
+	{
+		pthread_mutex_lock(&ps->lock);
+		ps->num_fields = t->dat.num_fields;
+		ps->width_known = true;
+		pthread_cond_broadcast(&ps->changed);
+		pthread_mutex_unlock(&ps->lock);
+	}
+}
+
+//parse the chunk starting at position start of slot seq
+static void parallel_chunk(struct parallel_thread *t, size_t seq, long start)
+{
+	struct parallel_scan* ps = t->ps;
+	struct buffer_ring* r = ps->ring;
+	size_t next = seq + 1;
+	long next_start = START_NONE;
+	size_t slot;
+	const char* begin;
+	const char* end;
+	double start_time;
+
+	//the column count comes from the first row, which is in the oldest chunk
+	//still being parsed whenever it is not known yet
+	pthread_mutex_lock(&ps->lock);
+	while(!ps->width_known && ps->next_commit != seq && !job_failed(ps->dat->failure))
+	{
+		pthread_cond_wait(&ps->changed, &ps->lock);
+	}
+	t->dat.width_known = ps->width_known;
+	t->dat.num_fields = ps->num_fields;
+	pthread_mutex_unlock(&ps->lock);
+	if(job_failed(ps->dat->failure))
+	{
+		thread_unwind();
+	}
+
+	t->dat.row = 0;
+	slot = seq % r->num_slots;
+	t->stream.offset = r->offset[slot] + start;
+	t->dat.offset = r->offset[slot] + start;
+	if(t->dat.index != NULL)
+	{
+		t->dat.index->len = 0;
+	}
+	begin = r->buff[slot] + start;
+	end = r->buff[slot] + r->size[slot];
+	if(!ps->contiguous)
+	{
+		parallel_parse(t, r->buff[slot] + start, r->size[slot] - start);
+	}
+	parallel_mark(ps, seq, 1);
+
+	//continue through the following slots up to the next record start
+	while(ring_has_slot(r, next))
+	{
+		slot = next % r->num_slots;
+
+		pthread_mutex_lock(&ps->lock);
+		while(ps->start[slot] == START_UNKNOWN && !job_failed(ps->dat->failure))
+		{
+			pthread_cond_wait(&ps->changed, &ps->lock);
+		}
+		next_start = ps->start[slot];
+		pthread_mutex_unlock(&ps->lock);
+		if(next_start == START_UNKNOWN)
+		{
+			thread_unwind();
+		}
+
+		if(next_start == START_NONE)
+		{
+			end = r->buff[slot] + r->size[slot];
+			if(!ps->contiguous)
+			{
+				parallel_parse(t, r->buff[slot], r->size[slot]);
+			}
+			parallel_mark(ps, next, 1);
+			++next;
+		}
+		else
+		{
+			end = r->buff[slot] + next_start;
+			if(!ps->contiguous)
+			{
+				parallel_parse(t, r->buff[slot], next_start);
+			}
+			parallel_mark(ps, next, 1);
+			break;
+		}
+	}
+
+	//a chunk of a mapped input is a single range, parsed without copies;
+	//its slots are only views, so they were given back above already
+	if(ps->contiguous)
+	{
+		start_time = t->dat.stats ? now() : 0;
+		view_parse(&t->dat, begin, end - begin, true);
+		if(t->dat.stats)
+		{
+			t->dat.timing.parse_time += now() - start_time;
+		}
+		parallel_width(t);
+	}
+	//this chunk runs to the end of the input
+	else if(next_start == START_NONE)
+	{
+		stream_fini(&t->stream, &t->dat);
+	}
+
+	batch_emit(&t->dat);
+	parallel_commit(t, seq, next);
+}
+
+//write a parsed chunk once every chunk before it has been written
+static void parallel_commit(struct parallel_thread *t, size_t seq, size_t next)
+{
+	struct parallel_scan* ps = t->ps;
+	struct data* d = ps->dat;
+
+	pthread_mutex_lock(&ps->lock);
+	while(ps->next_commit != seq && !job_failed(d->failure))
+	{
+		pthread_cond_wait(&ps->changed, &ps->lock);
+	}
+	pthread_mutex_unlock(&ps->lock);
+	if(job_failed(d->failure))
+	{
+		thread_unwind();
+	}
+
+	stage_commit(t->staged, t->num_staged);
+	if(d->index != NULL)
+	{
+		index_merge(d->index, t->dat.index, d->row);
+	}
+	__atomic_store_n(&d->row, d->row + t->dat.row, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&ps->lock);
+	ps->next_commit = next;
+	pthread_cond_broadcast(&ps->changed);
+	pthread_mutex_unlock(&ps->lock);
+}
+
+static void* thread_parallel_scan(void* data_ptr)
+{
+	struct parallel_thread* t = (struct parallel_thread*)data_ptr;
+	jmp_buf jump;
+
+	//an error stops every thread of the run (see fail())
+	if(setjmp(jump) == 0)
+	{
+		caught = &jump;
+		parallel_run(t);
+	}
+	else
+	{
+		parallel_abort(t->ps);
+	}
+	caught = NULL;
+
+	t->dat.timing.peak_carry = t->stream.capacity;
+	stream_free(&t->stream);
+	batch_free(&t->dat);
+
+	return NULL;
+}
+
+//parse the chunks that start in the slots this thread takes from the ring
+static void parallel_run(struct parallel_thread *t)
+{
+	struct parallel_scan* ps = t->ps;
+	struct buffer_ring* r = ps->ring;
+	long first[NUM_STATES];
+	unsigned char last[NUM_STATES];
+	size_t slot;
+	long seq;
+	long start;
+
+	while((seq = ring_acquire_full(r)) >= 0)
+	{
+		slot = seq % r->num_slots;
+		if(!ps->aligned)
+		{
+			scan_slot(ps->table, ps->dat->delim, ps->dat->quote, r->buff[slot], r->size[slot], first, last);
+		}
+
+		//the start waits on the slots before this one, which are scanned
+		//by the threads that took them without waiting on anything
+		pthread_mutex_lock(&ps->lock);
+		if(ps->aligned)
+		{
+			ps->start[slot] = 0;
+		}
+		else
+		{
+			memcpy(ps->first[slot], first, sizeof(first));
+			memcpy(ps->last[slot], last, sizeof(last));
+			ps->scanned[slot] = true;
+			parallel_resolve(ps);
+		}
+		pthread_cond_broadcast(&ps->changed);
+		while(ps->start[slot] == START_UNKNOWN && !job_failed(ps->dat->failure))
+		{
+			pthread_cond_wait(&ps->changed, &ps->lock);
+		}
+		start = ps->start[slot];
+		pthread_mutex_unlock(&ps->lock);
+		if(start == START_UNKNOWN)
+		{
+			thread_unwind();
+		}
+
+		//nothing before the first slot, and nothing after the start of a
+		//slot with none: the chunk before parses all of it
+		if(seq == 0 || start == START_NONE)
+		{
+			parallel_mark(ps, seq, 1);
+		}
+
+		if(start != START_NONE)
+		{
+			parallel_chunk(t, seq, start);
+		}
+	}
+}
+
+//a thread of the run has failed: stop reading and wake every waiting thread
+static void parallel_abort(struct parallel_scan *ps)
+{
+	__atomic_store_n(&ps->dat->stop, true, __ATOMIC_RELAXED);
+	ring_abort(ps->ring);
+	pthread_mutex_lock(&ps->lock);
+	pthread_cond_broadcast(&ps->changed);
+	pthread_mutex_unlock(&ps->lock);
+}
+
+//add a finished thread's --stats counters to the totals
+static void parallel_stats(struct parallel_thread *t)
+{
+	struct stage_stats* total = &t->ps->dat->timing;
+	size_t ndx;
+
+	total->parse_time += t->dat.timing.parse_time;
+	if(t->dat.arena.peak > total->peak_arena)
+	{
+		total->peak_arena = t->dat.arena.peak;
+	}
+	if(t->dat.field_slots > total->peak_fields)
+	{
+		total->peak_fields = t->dat.field_slots;
+	}
+	if(t->dat.timing.peak_carry > total->peak_carry)
+	{
+		total->peak_carry = t->dat.timing.peak_carry;
+	}
+
+	for(ndx = 0; ndx < t->num_staged; ++ndx)
+	{
+		t->staged[ndx].dest->bytes += t->staged[ndx].out.bytes;
+		t->staged[ndx].dest->emit_time += t->staged[ndx].out.emit_time;
+	}
+}
+
+//free what parallel_init() and parallel_thread_init() set up, once the
+//threads have finished
+static void parallel_free(struct parallel_scan *ps, struct parallel_thread *workers, size_t num_threads)
+{
+	struct parallel_thread* t;
+
+	for(t = workers; t < workers + num_threads; ++t)
+	{
+		stage_free(t->staged, t->num_staged);
+		if(t->dat.index != NULL)
+		{
+			free(t->dat.index->offsets);
+			free(t->dat.index);
+		}
+	}
+	free(workers);
+
+	free(ps->start);
+	free(ps->first);
+	free(ps->last);
+	free(ps->scanned);
+	free(ps->parts);
+	pthread_mutex_destroy(&ps->lock);
+	pthread_cond_destroy(&ps->changed);
+}
+
+//report an error: inside a csvreo_* call it is returned from the call in the
+//job's own thread, and in a thread csvreo_run() parses with it stops the
+//run (see job_catch).  The writer, spilling and progress threads have no
+//call to return to and never come here; their errors go to the job through
+//failure_record().  Only an error outside any job ends the process.
+static void fail(struct failure *f, int code, const char *fmt, ...)
+{
+	va_list args;
+	char message[sizeof(f->message)];
+
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	//a writer may have handed the job its error first
+	if(f != NULL && f->armed && pthread_equal(f->owner, pthread_self()))
+	{
+		failure_record(f, code, message);
+		longjmp(f->jump, 1);
+	}
+
+	//the threads of csvreo_run() stop, and it returns the first error
+	if(f != NULL && caught != NULL)
+	{
+		failure_record(f, code, message);
+		longjmp(*caught, 1);
+	}
+
+	fprintf(stderr, "ERROR: %s\n", message);
+	exit(code);
+}
+
+//keep the first error of a job, which several of its threads may raise
+static void failure_record(struct failure *f, int code, const char *message)
+{
+	int aok = ERR_CODE_AOK;
+
+	if(__atomic_compare_exchange_n(&f->code, &aok, code, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		snprintf(f->message, sizeof(f->message), "%s", message);
+	}
+}
+
+//whether a thread of the job has failed, so the others should stop
+static int job_failed(struct failure *f)
+{
+	return __atomic_load_n(&f->code, __ATOMIC_ACQUIRE) != ERR_CODE_AOK;
+}
+
+//leave a wait that another thread's error has ended, as if this thread had
+//failed too
+static void thread_unwind(void)
+{
+	longjmp(*caught, 1);
+}
+
+//run one step of csvreo_run() in the calling thread, catching its errors;
+//false if the job has failed
+static int job_catch(void (*step)(struct csvreo *job), struct csvreo *job)
+{
+	jmp_buf jump;
+	jmp_buf* outer = caught;
+
+	if(setjmp(jump) == 0)
+	{
+		caught = &jump;
+		step(job);
+	}
+	caught = outer;
+
+	return !job_failed(&job->failure);
+}
+
+//every csvreo_* call that can fail starts with JOB_ENTER and returns
+//through job_leave(); a failed job returns its error from then on
+#define JOB_ENTER(job) \
+	if(job_failed(&(job)->failure)) return job_leave(job); \
+	if(setjmp((job)->failure.jump) != 0) return job_leave(job); \
+	job_arm(job)
+
+static void job_arm(struct csvreo *job)
+{
+	job->failure.owner = pthread_self();
+	job->failure.armed = true;
+}
+
+static int job_leave(struct csvreo *job)
+{
+	job->failure.armed = false;
+	return __atomic_load_n(&job->failure.code, __ATOMIC_ACQUIRE);
+}
+
+//a copy of an option value that lives as long as the job, since outputs
+//and --where tests point into it
+static char* job_string(struct csvreo *job, const char *value)
+{
+	char** strings = realloc(job->strings, (job->num_strings + 1) * sizeof(char*));
+	char* copy = strdup(value);
+
+	if(strings == NULL || copy == NULL)
+	{
+		free(copy);
+		if(strings != NULL)
+		{
+			job->strings = strings;
+		}
+		fail(&job->failure, ERR_CODE_MEM, "unable to allocate option values.");
+	}
+	job->strings = strings;
+	job->strings[job->num_strings++] = copy;
+
+	return copy;
+}
+
+//check the options and work out what the outputs write
+static void job_plan(struct csvreo *job)
+{
+	if(job->state != JOB_SETUP)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "the input has already been read.");
+	}
+
+	check_opts(&job->dat);
+	plan_partitions(&job->dat);
+	plan_columns(&job->dat);
+	plan_emit(&job->dat);
+	plan_sort(&job->dat, job->sort_mem);
+	plan_distinct(&job->dat, job->distinct_mem);
+	plan_interleave(&job->dat);
+	plan_transcode(&job->dat);
+	pthread_once(&classify_once, scan_select);
+}
+
+//the first csvreo_feed() or csvreo_finish() sets up the parser
+static void job_start(struct csvreo *job)
+{
+	job_plan(job);
+	if(job->index_every > 0)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "--build-index needs --input.");
+	}
+	output_start(&job->dat, job->queue_blocks, job->compress_threads);
+	stream_init(&job->stream, &job->dat);
+	job->state = JOB_FEEDING;
+}
+
+struct csvreo* csvreo_new(void)
+{
+	struct csvreo* job = calloc(1, sizeof(struct csvreo));
+
+	if(job == NULL)
+	{
+		return NULL;
+	}
+
+	job->dat.infile = stdin;
+	job->dat.outputs = NULL;
+	job->dat.current_field = 0;
+	job->dat.row = 0;
+	job->dat.progress = false;
+	job->dat.num_fields = 0;
+	job->dat.field_slots = 0;
+	job->dat.needed = SIZE_MAX;
+	job->dat.reach = 0;
+	job->dat.wanted = NULL;
+	job->dat.width_known = false;
+	job->dat.stats = STATS_OFF;
+	memset(&job->dat.timing, 0, sizeof(job->dat.timing));
+	job->dat.offset = 0;
+	job->dat.index = NULL;
+	job->dat.first_row = 1;
+	job->dat.num_rows = SIZE_MAX;
+	job->dat.stop = false;
+	job->dat.batch = NULL;
+	job->dat.field_lengths = NULL;
+	job->dat.delim = '|';
+	job->dat.quote = '"';
+	job->dat.view = NULL;
+	arena_init(&job->dat.arena, &job->failure);
+	job->dat.row_buff = NULL;
+	job->dat.row_len = 0;
+	job->dat.row_capacity = 0;
+	job->dat.last = NULL;
+	job->dat.failure = &job->failure;
+
+	job->failure.code = ERR_CODE_AOK;
+	job->failure.armed = false;
+	job->progress_running = false;
+	job->masked = false;
+	job->state = JOB_SETUP;
+	job->num_buffers = CSVREO_DEFAULT_BUFFERS;
+	job->buffer_size = BUFSIZE;
+	job->num_threads = 0;
+	job->queue_blocks = CSVREO_DEFAULT_QUEUE;
+	job->compress_threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+	job->interval = DEFAULT_INTERVAL;
+	job->sort_mem = DEFAULT_SORT_MEM;
+	job->distinct_mem = DEFAULT_DISTINCT_MEM;
+
+	return job;
+}
+
+int csvreo_option(struct csvreo *job, int option, const char *value)
+{
+	JOB_ENTER(job);
+	job_option(job, option, value);
+	return job_leave(job);
+}
+
+static void job_option(struct csvreo *job, int option, const char *value)
+{
+	char* optarg = NULL;
+	char** inputs;
+
+	if(job->state != JOB_SETUP)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "options only apply before the input is read.");
+	}
+
+	//the value is copied; only these options go without one
+	if(value != NULL)
+	{
+		optarg = job_string(job, value);
+	}
+	else if(option != 'r' && option != 'R' && option != 'a' && option != 'A' &&
+			option != CSVREO_STATS && option != CSVREO_INDEX && option != CSVREO_ORDERED &&
+			option != CSVREO_UNORDERED && option != CSVREO_HEADER && option != CSVREO_URING &&
+			option != CSVREO_DISTINCT)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "option %d needs a value.", option);
+	}
+
+	switch(option)
+	{
+		case 'q':
+			job->dat.quote = optarg[0];
+		case 'Q':
+			if(job->dat.last == NULL)
+			{
+				fileAssign(&job->dat, "");
+			}
+			job->dat.last->outquote = optarg[0];
+		break;
+
+		case 'd':
+			job->dat.delim = optarg[0];
+		case 'D':
+			if(job->dat.last == NULL)
+			{
+				fileAssign(&job->dat, "");
+			}
+			job->dat.last->outdelim = optarg[0];
+		break;
+
+		case 'p':
+		case 'P':
+			job->dat.progress = (strcmp(optarg, "0") == 0) ? 0 : sizeAssign(optarg, "progress", &job->failure);
+		break;
+
+		case 'k':
+		case 'K':
+			keyAssign(&job->dat, optarg);
+		break;
+
+		case 'f':
+		case 'F':
+			fileAssign(&job->dat, optarg);
+		break;
+
+		case 'i':
+		case 'I':
+			inputs = realloc(job->inputs, (job->num_inputs + 1) * sizeof(char*));
+			if(inputs == NULL)
+			{
+				fail(&job->failure, ERR_CODE_MEM, "unable to allocate option values.");
+			}
+			job->inputs = inputs;
+			job->inputs[job->num_inputs++] = optarg;
+		break;
+
+		case CSVREO_ORDERED:
+			job->unordered = false;
+		break;
+
+		case CSVREO_UNORDERED:
+			job->unordered = true;
+		break;
+
+		case CSVREO_HEADER:
+			job->header = true;
+		break;
+
+		case 'r':
+		case 'R':
+			if(job->dat.last == NULL)
+			{
+				fileAssign(&job->dat, "");
+			}
+			job->dat.last->rev = true;
+		break;
+
+		case 'a':
+		case 'A':
+			if(job->dat.last == NULL)
+			{
+				fileAssign(&job->dat, "");
+			}
+			job->dat.last->all = true;
+		break;
+
+		case CSVREO_BUFFERS:
+			job->num_buffers = sizeAssign(optarg, "buffers", &job->failure);
+			if(job->num_buffers < 2)
+			{
+				fail(&job->failure, ERR_CODE_OPT, "at least 2 buffers are required.");
+			}
+		break;
+
+		case CSVREO_BUFSIZE:
+			job->buffer_size = sizeAssign(optarg, "bufsize", &job->failure);
+		break;
+
+		case CSVREO_THREADS:
+			//0 means one thread per online processor
+			job->num_threads = (strcmp(optarg, "0") == 0) ?
+							   (size_t)sysconf(_SC_NPROCESSORS_ONLN) :
+							   sizeAssign(optarg, "threads", &job->failure);
+		break;
+
+		case CSVREO_STATS:
+			if(optarg == NULL || strcmp(optarg, "text") == 0)
+			{
+				job->dat.stats = STATS_TEXT;
+			}
+			else if(strcmp(optarg, "json") == 0)
+			{
+				job->dat.stats = STATS_JSON;
+			}
+			else
+			{
+				fail(&job->failure, ERR_CODE_OPT, "invalid value %s for --stats.", optarg);
+			}
+		break;
+
+		case CSVREO_URING:
+			if(optarg == NULL)
+			{
+				job->uring = URING_ON;
+			}
+			else if(strcmp(optarg, "direct") == 0)
+			{
+				job->uring = URING_DIRECT;
+			}
+			else
+			{
+				fail(&job->failure, ERR_CODE_OPT, "invalid value %s for --io-uring.", optarg);
+			}
+		break;
+
+		case CSVREO_INTERVAL:
+			job->interval = intervalAssign(optarg, &job->failure);
+		break;
+
+		case CSVREO_PARTS:
+			if(job->dat.last == NULL)
+			{
+				fileAssign(&job->dat, "");
+			}
+			job->dat.last->num_parts = sizeAssign(optarg, "partitions", &job->failure);
+		break;
+
+		case CSVREO_PART_BY:
+			partAssign(&job->dat, optarg);
+		break;
+
+		case CSVREO_INDEX:
+			job->index_every = optarg ? sizeAssign(optarg, "build-index", &job->failure) : DEFAULT_INDEX_EVERY;
+		break;
+
+		case CSVREO_SORT_BY:
+			sortAssign(&job->dat, optarg);
+		break;
+
+		case CSVREO_SORT_MEM:
+			job->sort_mem = sizeAssign(optarg, "sort-mem", &job->failure);
+		break;
+
+		case CSVREO_DISTINCT:
+			if(job->dat.last == NULL)
+			{
+				fileAssign(&job->dat, "");
+			}
+			job->dat.last->distinct = true;
+		break;
+
+		case CSVREO_FORMAT:
+			formatAssign(&job->dat, optarg);
+		break;
+
+		case CSVREO_DISTINCT_MEM:
+			job->distinct_mem = sizeAssign(optarg, "distinct-mem", &job->failure);
+		break;
+
+		case CSVREO_ROWS:
+			rowsAssign(&job->dat, optarg);
+		break;
+
+		case CSVREO_WHERE:
+			whereAssign(&job->dat, optarg);
+		break;
+
+		case CSVREO_ZTHREADS:
+			//0 means one thread per online processor
+			if(strcmp(optarg, "0") != 0)
+			{
+				job->compress_threads = sizeAssign(optarg, "compress-threads", &job->failure);
+			}
+		break;
+
+		case CSVREO_QUEUE:
+			//0 turns the writer threads off
+			job->queue_blocks = (strcmp(optarg, "0") == 0) ? 0 : sizeAssign(optarg, "queue", &job->failure);
+		break;
+
+		default:
+			fail(&job->failure, ERR_CODE_OPT, "unknown option %d.", option);
+	}
+}
+
+int csvreo_output_memory(struct csvreo *job)
+{
+	return csvreo_output_callback(job, NULL, NULL);
+}
+
+//a callback of NULL keeps the rows in memory
+int csvreo_output_callback(struct csvreo *job, csvreo_write write, void *ctx)
+{
+	struct output_file* output;
+
+	JOB_ENTER(job);
+	if(job->state != JOB_SETUP)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "outputs can only be added before the input is read.");
+	}
+
+	output = output_new(&job->dat, write ? "(callback)" : "(memory)");
+	output->sink = malloc(sizeof(struct out_buffer));
+	if(output->sink == NULL)
+	{
+		fail(&job->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+	}
+	output->own_sink = output->sink;
+	sink_init(output->sink, -1, CODEC_NONE, &job->failure);
+	output->sink->write = write;
+	output->sink->ctx = ctx;
+
+	return job_leave(job);
+}
+
+int csvreo_output_fd(struct csvreo *job, int fd)
+{
+	struct output_file* output;
+
+	JOB_ENTER(job);
+	if(job->state != JOB_SETUP)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "outputs can only be added before the input is read.");
+	}
+	if(fd < 0)
+	{
+		fail(&job->failure, ERR_CODE_FIL, "%d is not a file descriptor.", fd);
+	}
+
+	output = output_new(&job->dat, "(fd)");
+	output->sink = malloc(sizeof(struct out_buffer));
+	if(output->sink == NULL)
+	{
+		fail(&job->failure, ERR_CODE_MEM, "unable to allocate output buffer.");
+	}
+	output->own_sink = output->sink;
+	sink_init(output->sink, fd, CODEC_NONE, &job->failure);
+
+	return job_leave(job);
+}
+
+int csvreo_feed(struct csvreo *job, const char *buff, size_t len)
+{
+	JOB_ENTER(job);
+	if(job->state == JOB_SETUP)
+	{
+		job_start(job);
+	}
+	else if(job->state != JOB_FEEDING)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "the input has already been finished.");
+	}
+
+	//the records after --rows are not needed
+	if(!job->dat.stop)
+	{
+		stream_parse(&job->stream, buff, len, &job->dat);
+	}
+	job->dat.timing.bytes_read += len;
+
+	return job_leave(job);
+}
+
+int csvreo_finish(struct csvreo *job)
+{
+	JOB_ENTER(job);
+	if(job->state == JOB_SETUP)
+	{
+		job_start(job);
+	}
+	else if(job->state != JOB_FEEDING)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "the input has already been finished.");
+	}
+
+	stream_fini(&job->stream, &job->dat);
+	job->dat.timing.peak_carry = job->stream.capacity;
+	stream_free(&job->stream);
+	job->state = JOB_DONE;
+
+	batch_emit(&job->dat);
+	output_finish(&job->dat);
+
+	return job_leave(job);
+}
+
+//read the input with the job's threads; an error in any of them stops
+//them all and is returned once they have been joined
+int csvreo_run(struct csvreo *job)
+{
+	JOB_ENTER(job);
+	job->wall = now();
+	job->cpu = clock();
+	job_leave(job);
+
+	//errors from here on stop every thread of the job, and are returned once
+	//the threads have been joined
+	if(job_catch(job_open, job) && job_catch(job_begin, job) &&
+	   job_catch(job->num_inputs > 1 ? files_read : job_read, job))
+	{
+		job_catch(job_end, job);
+	}
+	job_stop(job);
+	job->wall = now() - job->wall;
+	job->cpu = (clock() - job->cpu)/CLOCKS_PER_SEC;
+
+	return job_leave(job);
+}
+
+//open the input and its index and set up the buffers for job_read()
+static void job_open(struct csvreo *job)
+{
+	struct data* dat = &job->dat;
+
+	//SIGUSR1 is taken by the progress thread, so no other thread may get it;
+	//it is blocked before the input is opened, since that waits on a pipe
+	//for the bytes telling whether it is compressed.  job_stop() gives the
+	//caller its signals back.
+	if(dat->progress)
+	{
+		sigset_t usr1;
+		sigemptyset(&usr1);
+		sigaddset(&usr1, SIGUSR1);
+		pthread_sigmask(SIG_BLOCK, &usr1, &job->mask);
+		job->masked = true;
+	}
+
+	job_plan(job);
+	job->state = JOB_DONE;
+
+	//--threads is how many inputs are parsed at once when there are several
+	if(job->num_inputs > 1)
+	{
+		inputs_open(job);
+		return;
+	}
+	if(job->num_threads == 0)
+	{
+		job->num_threads = 1;
+	}
+	if(job->num_inputs == 1)
+	{
+		job->input_path = job->inputs[0];
+	}
+
+	//the index lives next to the input
+	if(job->index_every > 0 && job->input_path == NULL)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "--build-index needs --input.");
+	}
+	if(job->input_path != NULL)
+	{
+		job->index_path = malloc(strlen(job->input_path) + 5);
+		if(job->index_path == NULL)
+		{
+			fail(&job->failure, ERR_CODE_MEM, "unable to allocate field buffers.");
+		}
+		sprintf(job->index_path, "%s.idx", job->input_path);
+	}
+
+	//rows are only numbered as they are written, so --rows is parsed by one
+	//thread (from the nearest indexed record, if there is an index)
+	if(dat->first_row > 1 || dat->num_rows != SIZE_MAX)
+	{
+		job->num_threads = 1;
+	}
+
+	//regular files are mapped; anything else is read through the buffers
+	if(job->input_path != NULL)
+	{
+		job->map = map_input(dat, job->input_path, &job->map_len);
+		job->mapped = job->map;
+	}
+
+	//compressed input is decompressed into the buffers, straight from the
+	//mapping if there is one
+	if(job->map != NULL && codec_detect((const unsigned char*)job->map, job->map_len) != CODEC_NONE)
+	{
+		input_open(&job->input, dat->infile, job->map, job->map_len, &job->failure);
+		job->input_open = true;
+		job->map = NULL;
+	}
+	else if(job->map == NULL)
+	{
+		input_open(&job->input, dat->infile, NULL, 0, &job->failure);
+		job->input_open = true;
+	}
+
+	//--io-uring reads a plain file into the buffers instead, with several
+	//reads in flight (direct reads need whole blocks)
+	if(job->uring != URING_OFF && job->map != NULL)
+	{
+		munmap((void*)job->mapped, job->map_len);
+		job->map = NULL;
+		job->mapped = NULL;
+		if(job->uring == URING_DIRECT)
+		{
+			job->buffer_size = (job->buffer_size + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+		}
+	}
+	else
+	{
+		job->uring = URING_OFF;
+	}
+
+	//percent done and ETA need the size of the input (compressed input's
+	//size is only known once it has been read)
+	if(job->map != NULL)
+	{
+		job->total = job->map_len;
+	}
+	else if(job->input.kind == CODEC_NONE && fstat(fileno(dat->infile), &job->st) == 0 && S_ISREG(job->st.st_mode))
+	{
+		job->total = job->st.st_size;
+	}
+
+	//an index of the input is built in this pass, or one built earlier is
+	//used to seek (which needs the mapping)
+	if(job->input_path != NULL)
+	{
+		fstat(fileno(dat->infile), &job->st);
+	}
+	if(job->index_every > 0)
+	{
+		dat->index = index_new(job->index_every, &job->failure);
+	}
+	else if(job->map != NULL)
+	{
+		job->loaded = index_load(job->index_path, &job->st, dat);
+	}
+
+	//every thread holds a slot while it waits for the next one to be scanned
+	if(job->num_threads > 1 && job->num_buffers < 2 * job->num_threads)
+	{
+		job->num_buffers = 2 * job->num_threads;
+	}
+
+	ring_init(&job->ring, job->num_buffers, job->buffer_size, job->map != NULL, &job->failure);
+	job->ring_open = true;
+
+	//without io_uring the file is read the usual way
+	if(job->uring != URING_OFF)
+	{
+		job->reader_open = uring_open(&job->reader, job->input_path, &job->ring,
+									  job->uring == URING_DIRECT, &job->failure);
+		if(!job->reader_open)
+		{
+			input_open(&job->input, dat->infile, NULL, 0, &job->failure);
+			job->input_open = true;
+		}
+	}
+}
+
+//check that the inputs of a run over several of them can be read; each is
+//only opened by the worker that parses it
+static void inputs_open(struct csvreo *job)
+{
+	struct stat st;
+	size_t ndx;
+
+	if(job->dat.first_row > 1 || job->dat.num_rows != SIZE_MAX)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "--rows needs a single input.");
+	}
+	if(job->index_every > 0)
+	{
+		fail(&job->failure, ERR_CODE_OPT, "--build-index needs a single input.");
+	}
+
+	//the size of compressed inputs is only known once they have been read
+	job->total = 0;
+	for(ndx = 0; ndx < job->num_inputs; ++ndx)
+	{
+		if(stat(job->inputs[ndx], &st) != 0 || access(job->inputs[ndx], R_OK) != 0)
+		{
+			fail(&job->failure, ERR_CODE_FIL, "File %s failed to open.", job->inputs[ndx]);
+		}
+		job->total += S_ISREG(st.st_mode) ? st.st_size : 0;
+	}
+
+	if(job->num_threads == 0)
+	{
+		job->num_threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(job->num_threads > job->num_inputs)
+	{
+		job->num_threads = job->num_inputs;
+	}
+}
+
+//read and parse the input opened by job_open() and write the outputs
+static void job_read(struct csvreo *job)
+{
+	struct data* dat = &job->dat;
+	struct buffer_ring* ring = &job->ring;
+	struct row_index* index = job->loaded;
+	const char* map = job->map;
+	size_t map_len = job->map_len;
+	size_t num_threads = job->num_threads;
+	size_t cursor = 0;
+	struct view_stream stream;
+	struct thread_data t_data;
+	struct parallel_scan ps;
+	struct parallel_thread* volatile workers = NULL;
+	pthread_t thread_id;
+	size_t volatile started = 0;
+	jmp_buf jump;
+	jmp_buf* outer = caught;
+	size_t c_count = 0;
+	size_t offset;
+	size_t ndx;
+	double start;
+	long idx;
+	int done;
+
+	t_data.ring = ring;
+	t_data.stream = &stream;
+	t_data.dat = dat;
+
+	if(num_threads > 1)
+	{
+		parallel_init(&ps, ring, dat);
+		ps.contiguous = (map != NULL);
+		ps.aligned = (map != NULL && index != NULL);
+		workers = malloc(num_threads * sizeof(struct parallel_thread));
+		if(workers == NULL)
+		{
+			fail(dat->failure, ERR_CODE_MEM, "unable to allocate thread data.");
+		}
+		for(ndx = 0; ndx < num_threads; ++ndx)
+		{
+			parallel_thread_init(&workers[ndx], &ps);
+		}
+	}
+	else
+	{
+		stream_init(&stream, dat);
+	}
+
+	//an error from here on stops the parser threads, which are joined
+	//before it is passed on
+	if(setjmp(jump) != 0)
+	{
+		if(num_threads > 1)
+		{
+			parallel_abort(&ps);
+		}
+		else
+		{
+			__atomic_store_n(&dat->stop, true, __ATOMIC_RELAXED);
+			ring_abort(ring);
+		}
+	}
+	else
+	{
+		caught = &jump;
+
+		//a mapped input needs no reader, so one thread parses it directly, a
+		//buffer's worth at a time so progress can follow it
+		if(map != NULL && num_threads == 1)
+		{
+			start = dat->stats ? now() : 0;
+			offset = 0;
+			if(index != NULL && index->len > 0)
+			{
+				cursor = (dat->first_row - 1) / index->every;
+				if(cursor >= index->len)
+				{
+					cursor = index->len - 1;
+				}
+				offset = index->offsets[cursor];
+				dat->row = cursor * index->every;
+				stream.offset = offset;
+			}
+			for(; offset < map_len && !dat->stop; offset += c_count)
+			{
+				c_count = (map_len - offset < ring->slot_size) ? map_len - offset : ring->slot_size;
+				stream_parse(&stream, map + offset, c_count, dat);
+				__atomic_store_n(&dat->timing.bytes_read, offset + c_count, __ATOMIC_RELAXED);
+			}
+			stream_fini(&stream, dat);
+			if(dat->stats)
+			{
+				dat->timing.parse_time += now() - start;
+			}
+		}
+		//start thread(s)
+		else if(num_threads > 1)
+		{
+			for(ndx = 0; ndx < num_threads; ++ndx)
+			{
+				if(pthread_create(&workers[ndx].id, NULL, thread_parallel_scan, &workers[ndx]) != 0)
+				{
+					fail(dat->failure, ERR_CODE_PTH, "unable to create a thread: %s.", strerror(errno));
+				}
+				started++;
+			}
+		}
+		else
+		{
+			if(pthread_create(&thread_id, NULL, thread_io_scan, &t_data) != 0)
+			{
+				fail(dat->failure, ERR_CODE_PTH, "unable to create a thread: %s.", strerror(errno));
+			}
+			started++;
+		}
+
+		//read; blocks while every slot is waiting to be parsed
+		done = (map != NULL);
+
+		//slots of a mapped input are views of the mapping
+		for(offset = 0; map != NULL && num_threads > 1 && offset < map_len; offset += c_count)
+		{
+			idx = ring_acquire_empty(ring);
+			if(idx < 0)
+			{
+				break;
+			}
+			c_count = (map_len - offset < ring->slot_size) ? map_len - offset : ring->slot_size;
+
+			//with an index every slot runs up to a record start
+			if(ps.aligned)
+			{
+				c_count = index_next(index, &cursor, offset + c_count);
+				c_count = (c_count < map_len) ? c_count - offset : map_len - offset;
+			}
+			ring->buff[idx] = (char*)map + offset;
+			ring_publish(ring, c_count);
+			__atomic_store_n(&dat->timing.bytes_read, offset + c_count, __ATOMIC_RELAXED);
+		}
+
+		if(job->reader_open)
+		{
+			uring_read(&job->reader, ring, dat);
+			done = true;
+		}
+
+		while(!done)
+		{
+			idx = ring_acquire_empty(ring);
+			if(idx < 0)
+			{
+				break;
+			}
+			start = dat->stats ? now() : 0;
+			c_count = input_read(&job->input, ring->buff[idx], ring->slot_size);
+			if(dat->stats)
+			{
+				dat->timing.read_time += now() - start;
+			}
+			__atomic_store_n(&dat->timing.bytes_read, dat->timing.bytes_read + c_count, __ATOMIC_RELAXED);
+
+			if(c_count > 0)
+			{
+				ring_publish(ring, c_count);
+			}
+
+			//a slot may be published part full when the input is a pipe; only
+			//an empty read is the end of the input.  The records after --rows
+			//are not needed.
+			if(c_count == 0 || __atomic_load_n(&dat->stop, __ATOMIC_RELAXED))
+			{
+				done = true;
+			}
+		}
+	}
+	caught = outer;
+	ring_finish(ring);
+
+	if(num_threads > 1)
+	{
+		//the thread that parsed the last chunk has already finished the parser
+		for(ndx = 0; ndx < started; ++ndx)
+		{
+			pthread_join(workers[ndx].id, NULL);
+			parallel_stats(&workers[ndx]);
+		}
+		parallel_free(&ps, workers, num_threads);
+	}
+	else
+	{
+		if(started > 0)
+		{
+			pthread_join(thread_id, NULL);
+
+			//finish unless a thread failed
+			if(!job_failed(dat->failure))
+			{
+				stream_fini(&stream, dat);
+			}
+		}
+		dat->timing.peak_carry = stream.capacity;
+		stream_free(&stream);
+	}
+	dat->timing.full_waits = ring->full_waits;
+	dat->timing.empty_waits += ring->empty_waits;
+
+	if(job_failed(dat->failure))
+	{
+		thread_unwind();
+	}
+}
+
+//start the threads that run alongside the parser
+static void job_begin(struct csvreo *job)
+{
+	output_start(&job->dat, job->queue_blocks, job->compress_threads);
+	if(job->dat.progress)
+	{
+		progress_start(&job->progress, &job->dat, job->total, job->interval,
+					   (job->dat.progress > 1) ? job->dat.progress : 0);
+		job->progress_running = true;
+	}
+}
+
+//write what is left and wait for the outputs
+static void job_end(struct csvreo *job)
+{
+	struct data* dat = &job->dat;
+
+	batch_emit(dat);
+	output_finish(dat);
+	if(dat->index != NULL)
+	{
+		dat->index->rows = dat->row;
+		index_save(dat->index, job->index_path, &job->st, dat);
+	}
+}
+
+//stop the progress thread and put back the caller's signals, whether the
+//run worked or not
+static void job_stop(struct csvreo *job)
+{
+	if(job->progress_running)
+	{
+		progress_finish(&job->progress);
+		job->progress_running = false;
+	}
+	if(job->masked)
+	{
+		pthread_sigmask(SIG_SETMASK, &job->mask, NULL);
+		job->masked = false;
+	}
+}
+
+//parse several inputs at once, each by one of job->num_threads workers
+static void files_read(struct csvreo *job)
+{
+	struct file_pool pool;
+	struct file_worker* workers;
+	struct file_worker* w;
+	size_t volatile ready = 0;
+	size_t volatile started = 0;
+	jmp_buf jump;
+	jmp_buf* outer = caught;
+
+	pool.job = job;
+	pool.next = 0;
+	pool.turn = 0;
+	pool.num_fields = 0;
+	pool.width_known = false;
+	pool.started = false;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.changed, NULL);
+	pthread_mutex_init(&pool.write, NULL);
+
+	workers = malloc(job->num_threads * sizeof(struct file_worker));
+	if(workers == NULL)
+	{
+		fail(job->dat.failure, ERR_CODE_MEM, "unable to allocate thread data.");
+	}
+
+	//an error from here on stops the workers, which are joined before it is
+	//passed on
+	if(setjmp(jump) != 0)
+	{
+		file_abort(&pool);
+	}
+	else
+	{
+		caught = &jump;
+
+		//every worker copies the job's data before any of them starts
+		//changing it
+		for(w = workers; w < workers + job->num_threads; ++w)
+		{
+			w->pool = &pool;
+			w->counted = 0;
+			w->input_open = false;
+			w->map = NULL;
+			w->writing = false;
+			w->stream.carry = NULL;
+			w->buff = malloc(job->buffer_size);
+			if(w->buff == NULL)
+			{
+				fail(job->dat.failure, ERR_CODE_MEM, "unable to allocate input buffers.");
+			}
+			w->staged = stage_init(&w->dat, &job->dat, &w->num_staged);
+			w->dat.infile = NULL;
+			ready++;
+		}
+		for(w = workers; w < workers + job->num_threads; ++w)
+		{
+			if(pthread_create(&w->id, NULL, thread_file_scan, w) != 0)
+			{
+				fail(job->dat.failure, ERR_CODE_PTH, "unable to create a thread: %s.", strerror(errno));
+			}
+			started++;
+		}
+	}
+	caught = outer;
+
+	for(w = workers; w < workers + ready; ++w)
+	{
+		if(w < workers + started)
+		{
+			pthread_join(w->id, NULL);
+			file_stats(w);
+		}
+		stage_free(w->staged, w->num_staged);
+		free(w->buff);
+	}
+	free(workers);
+
+	pthread_mutex_destroy(&pool.lock);
+	pthread_cond_destroy(&pool.changed);
+	pthread_mutex_destroy(&pool.write);
+
+	if(job_failed(job->dat.failure))
+	{
+		thread_unwind();
+	}
+}
+
+//a worker has failed: stop the others once their inputs are done with
+static void file_abort(struct file_pool *pool)
+{
+	__atomic_store_n(&pool->job->dat.stop, true, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_broadcast(&pool->changed);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void* thread_file_scan(void* data_ptr)
+{
+	struct file_worker* w = (struct file_worker*)data_ptr;
+	struct file_pool* pool = w->pool;
+	size_t file;
+	jmp_buf jump;
+
+	//an error stops the other workers too (see fail())
+	if(setjmp(jump) != 0)
+	{
+		if(w->writing)
+		{
+			w->writing = false;
+			pthread_mutex_unlock(&pool->write);
+		}
+		stream_free(&w->stream);
+		file_close(w);
+		file_abort(pool);
+	}
+	else
+	{
+		caught = &jump;
+		for(;;)
+		{
+			pthread_mutex_lock(&pool->lock);
+			file = pool->next++;
+			pthread_mutex_unlock(&pool->lock);
+			if(file >= pool->job->num_inputs || job_failed(pool->job->dat.failure))
+			{
+				break;
+			}
+			file_parse(w, file);
+		}
+	}
+	caught = NULL;
+
+	batch_free(&w->dat);
+
+	return NULL;
+}
+
+//parse input number file a buffer at a time, handing its rows on between
+//buffers as file_commit() allows
+static void file_parse(struct file_worker *w, size_t file)
+{
+	struct file_pool* pool = w->pool;
+	struct csvreo* job = pool->job;
+	struct data* d = &w->dat;
+	const char* plain = NULL;
+	const char* buff;
+	size_t offset;
+	size_t n;
+	double start;
+
+	//the column count comes from the first input's first row, as it would
+	//if the inputs were one file
+	pthread_mutex_lock(&pool->lock);
+	while(file > 0 && !pool->started && !job_failed(d->failure))
+	{
+		pthread_cond_wait(&pool->changed, &pool->lock);
+	}
+	d->num_fields = pool->num_fields;
+	d->width_known = pool->width_known;
+	pthread_mutex_unlock(&pool->lock);
+	if(job_failed(d->failure))
+	{
+		thread_unwind();
+	}
+
+	//plain regular files are parsed straight from the mapping
+	w->map_len = 0;
+	w->map = map_input(d, job->inputs[file], &w->map_len);
+	if(w->map != NULL && codec_detect((const unsigned char*)w->map, w->map_len) == CODEC_NONE)
+	{
+		plain = w->map;
+	}
+	else
+	{
+		input_open(&w->input, d->infile, w->map, w->map_len, d->failure);
+		w->input_open = true;
+	}
+
+	//the header of every input but the first is left out
+	d->row = 0;
+	w->counted = 0;
+	d->first_row = (job->header && file > 0) ? 2 : 1;
+	stream_init(&w->stream, d);
+
+	for(offset = 0; ; offset += n)
+	{
+		if(plain != NULL)
+		{
+			n = (w->map_len - offset < job->buffer_size) ? w->map_len - offset : job->buffer_size;
+			buff = plain + offset;
+		}
+		else
+		{
+			start = d->stats ? now() : 0;
+			n = input_read(&w->input, w->buff, job->buffer_size);
+			if(d->stats)
+			{
+				d->timing.read_time += now() - start;
+			}
+			buff = w->buff;
+		}
+		if(n == 0)
+		{
+			break;
+		}
+
+		start = d->stats ? now() : 0;
+		stream_parse(&w->stream, buff, n, d);
+		if(d->stats)
+		{
+			d->timing.parse_time += now() - start;
+		}
+		__atomic_add_fetch(&job->dat.timing.bytes_read, n, __ATOMIC_RELAXED);
+		file_commit(w, file, false);
+	}
+
+	stream_fini(&w->stream, d);
+	if(w->stream.capacity > d->timing.peak_carry)
+	{
+		d->timing.peak_carry = w->stream.capacity;
+	}
+	stream_free(&w->stream);
+	file_commit(w, file, true);
+	file_close(w);
+}
+
+//close the input w is parsing, if it has one open
+static void file_close(struct file_worker *w)
+{
+	if(w->input_open)
+	{
+		input_close(&w->input);
+		w->input_open = false;
+	}
+	if(w->map != NULL)
+	{
+		munmap((void*)w->map, w->map_len);
+		w->map = NULL;
+	}
+	if(w->dat.infile != NULL)
+	{
+		fclose(w->dat.infile);
+		w->dat.infile = NULL;
+	}
+}
+
+//write the rows w has parsed of input number file: with --unordered right
+//away, otherwise once every input before it is done; until then up to
+//FILE_HOLD bytes are held in memory
+static void file_commit(struct file_worker *w, size_t file, int last)
+{
+	struct file_pool* pool = w->pool;
+	struct csvreo* job = pool->job;
+	size_t held = 0;
+	size_t ndx;
+	size_t part;
+
+	batch_emit(&w->dat);
+	for(ndx = 0; ndx < w->num_staged; ++ndx)
+	{
+		held += w->staged[ndx].sink.len;
+		for(part = 0; part < w->staged[ndx].out.num_parts; ++part)
+		{
+			held += w->staged[ndx].parts[part].len;
+		}
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if(!job->unordered && pool->turn != file && !last && held < FILE_HOLD)
+	{
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+	while(!job->unordered && pool->turn != file && !job_failed(job->dat.failure))
+	{
+		pthread_cond_wait(&pool->changed, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if(job_failed(job->dat.failure))
+	{
+		thread_unwind();
+	}
+
+	pthread_mutex_lock(&pool->write);
+	w->writing = true;
+	stage_commit(w->staged, w->num_staged);
+	__atomic_add_fetch(&job->dat.row, w->dat.row - w->counted, __ATOMIC_RELAXED);
+	w->counted = w->dat.row;
+	w->writing = false;
+	pthread_mutex_unlock(&pool->write);
+
+	//the first input's first row has been parsed by now, unless it is empty
+	pthread_mutex_lock(&pool->lock);
+	if(file == 0 && (last || w->dat.width_known))
+	{
+		pool->num_fields = w->dat.num_fields;
+		pool->width_known = w->dat.width_known;
+		pool->started = true;
+	}
+	if(last && !job->unordered)
+	{
+		pool->turn = file + 1;
+	}
+	pthread_cond_broadcast(&pool->changed);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+//add a finished worker's --stats counters to the totals
+static void file_stats(struct file_worker *w)
+{
+	struct stage_stats* total = &w->pool->job->dat.timing;
+	size_t ndx;
+
+	total->read_time += w->dat.timing.read_time;
+	total->parse_time += w->dat.timing.parse_time;
+	if(w->dat.arena.peak > total->peak_arena)
+	{
+		total->peak_arena = w->dat.arena.peak;
+	}
+	if(w->dat.field_slots > total->peak_fields)
+	{
+		total->peak_fields = w->dat.field_slots;
+	}
+	if(w->dat.timing.peak_carry > total->peak_carry)
+	{
+		total->peak_carry = w->dat.timing.peak_carry;
+	}
+
+	for(ndx = 0; ndx < w->num_staged; ++ndx)
+	{
+		w->staged[ndx].dest->bytes += w->staged[ndx].out.bytes;
+		w->staged[ndx].dest->emit_time += w->staged[ndx].out.emit_time;
+	}
+}
+
+const char* csvreo_memory(struct csvreo *job, size_t n, size_t *len)
+{
+	struct output_file* output;
+
+	for(output = job->dat.outputs; output != NULL && n > 0; output = output->next, --n);
+	if(output == NULL || output->sink->fd >= 0 || output->sink->write != NULL || output->deferred)
+	{
+		*len = 0;
+		return NULL;
+	}
+
+	*len = output->sink->len;
+	return output->sink->buff ? output->sink->buff : "";
+}
+
+size_t csvreo_rows(struct csvreo *job)
+{
+	return __atomic_load_n(&job->dat.row, __ATOMIC_RELAXED);
+}
+
+double csvreo_time(struct csvreo *job)
+{
+	return job->wall;
+}
+
+void csvreo_report(struct csvreo *job)
+{
+	if(job->dat.stats)
+	{
+		if(job->dat.arena.peak > job->dat.timing.peak_arena)
+		{
+			job->dat.timing.peak_arena = job->dat.arena.peak;
+		}
+		if(job->dat.field_slots > job->dat.timing.peak_fields)
+		{
+			job->dat.timing.peak_fields = job->dat.field_slots;
+		}
+		stats_report(&job->dat, job->wall, job->cpu);
+	}
+}
+
+const char* csvreo_error(struct csvreo *job)
+{
+	return job_failed(&job->failure) ? job->failure.message : "no error.";
+}
+
+void csvreo_free(struct csvreo *job)
+{
+	struct output_file* output;
+	struct output_file* next;
+	size_t ndx;
+
+	if(job == NULL)
+	{
+		return;
+	}
+
+	//writers still running (a job that failed) are stopped first; a job
+	//that failed before it was planned has no partitions yet, and an output
+	//that failed to start may have no sink
+	for(output = job->dat.outputs; output != NULL; output = output->next)
+	{
+		if(output->dedup != NULL)
+		{
+			distinct_free(output);
+		}
+		if(output->sort != NULL)
+		{
+			sort_free(output);
+		}
+		for(ndx = 0; output->parts != NULL && ndx < output->num_parts; ++ndx)
+		{
+			queue_free(&output->parts[ndx]);
+		}
+		if(output->own_sink != NULL)
+		{
+			queue_free(output->own_sink);
+		}
+	}
+
+	for(output = job->dat.outputs; output != NULL; output = next)
+	{
+		next = output->next;
+		for(ndx = 0; output->parts != NULL && ndx < output->num_parts; ++ndx)
+		{
+			if(output->parts[ndx].fd >= 0)
+			{
+				close(output->parts[ndx].fd);
+			}
+			free(output->parts[ndx].buff);
+		}
+
+		//outputs to stdout share one buffer, owned by the first of them
+		free(output->parts);
+		if(output->own_sink != NULL)
+		{
+			free(output->own_sink->buff);
+			free(output->own_sink);
+		}
+		if(output->outfile != NULL && output->outfile != stdout)
+		{
+			fclose(output->outfile);
+		}
+		else if(output->outfile == stdout)
+		{
+			fflush(stdout);
+		}
+		free(output->keyorder);
+		free(output->columns);
+		free(output->where);
+		free(output->part_columns);
+		free(output->sort_columns);
+		free(output);
+	}
+
+	if(job->state == JOB_FEEDING)
+	{
+		stream_free(&job->stream);
+	}
+	if(job->input_open)
+	{
+		input_close(&job->input);
+	}
+	if(job->reader_open)
+	{
+		uring_close(&job->reader);
+	}
+	if(job->ring_open)
+	{
+		ring_free(&job->ring);
+	}
+	if(job->mapped != NULL)
+	{
+		munmap((void*)job->mapped, job->map_len);
+	}
+	if(job->dat.infile != NULL && job->dat.infile != stdin)
+	{
+		fclose(job->dat.infile);
+	}
+	if(job->dat.index != NULL)
+	{
+		free(job->dat.index->offsets);
+		free(job->dat.index);
+	}
+	if(job->loaded != NULL)
+	{
+		free(job->loaded->offsets);
+		free(job->loaded);
+	}
+	batch_free(&job->dat);
+	free(job->dat.wanted);
+	free(job->index_path);
+	free(job->inputs);
+	for(ndx = 0; ndx < job->num_strings; ++ndx)
+	{
+		free(job->strings[ndx]);
+	}
+	free(job->strings);
+	free(job);
+}
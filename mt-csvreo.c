@@ -30,48 +30,22 @@
  * POSSIBILITY OF SUCH DAMAGE.
  * -----------------------------------------------------------------------------
  *
+ * The csvreo command line; the work is done by libcsvreo.c.
  *
- * TODO: allow reading from input file in addition to stdin
- *		 config file
+ *    cc -O2 -o csvreo mt-csvreo.c libcsvreo.c -lpthread -lz
  *
+ * TODO: config file
  *
  ******************************************************************************/
 
-#include <time.h>
 #include <stdio.h>
-#include <ctype.h>
-#include <string.h>
-#include <getopt.h>
 #include <stdlib.h>
-#include <pthread.h>
-#include "libcsv-3.0.3/csv.h"
+#include <getopt.h>
+#include "csvreo.h"
 
 #define VERSION "2.1"
 
-//1 MiB
-#define BUFSIZE 1048576
-
-#define DEFAULT_PROG 1000000
-
-#define true  1
-#define false 0
-
-#define ERR_CODE_AOK 0  /* success (a-OK) */
-#define ERR_CODE_CSV 1  /* Error in the libcsv parser */
-#define ERR_CODE_XKY 2  /* Too many keys (eXtra KeYs) */
-#define ERR_CODE_NKY 3  /* No key */
-#define ERR_CODE_KOR 4  /* Key out of range */
-#define ERR_CODE_BDQ 5  /* Invalid quote */
-#define ERR_CODE_BDD 6  /* Invalid delimiter */
-#define ERR_CODE_EQD 7  /* Equal quote and delimiter */
-#define ERR_CODE_MEM 8  /* Memory error */
-#define ERR_CODE_FIL 9  /* File error */
-#define ERR_CODE_PTH 10 /* Thread error */
-
-#define EMPTY 0
-#define FULL  1
-#define BUSY  2
-#define DONE  3
+void usage(int code);
 
 struct option long_options[] =
 {
@@ -83,6 +57,8 @@ struct option long_options[] =
    {"keys",     required_argument, 0, 'K'},
    {"file",     required_argument, 0, 'f'},
    {"file",     required_argument, 0, 'F'},
+   {"input",    required_argument, 0, 'i'},
+   {"input",    required_argument, 0, 'I'},
    {"progress", required_argument, 0, 'p'},
    {"progress", required_argument, 0, 'P'},
    {"reverse",  no_argument,       0, 'r'},
@@ -91,348 +67,91 @@ struct option long_options[] =
    {"all",		no_argument,       0, 'A'},
    {"help",     no_argument,       0, 'h'},
    {"help",     no_argument,       0, 'H'},
+   {"buffers",  required_argument, 0, CSVREO_BUFFERS},
+   {"bufsize",  required_argument, 0, CSVREO_BUFSIZE},
+   {"threads",  required_argument, 0, CSVREO_THREADS},
+   {"queue",    required_argument, 0, CSVREO_QUEUE},
+   {"stats",    optional_argument, 0, CSVREO_STATS},
+   {"progress-interval", required_argument, 0, CSVREO_INTERVAL},
+   {"compress-threads", required_argument, 0, CSVREO_ZTHREADS},
+   {"where",    required_argument, 0, CSVREO_WHERE},
+   {"partitions", required_argument, 0, CSVREO_PARTS},
+   {"partition-by", required_argument, 0, CSVREO_PART_BY},
+   {"build-index", optional_argument, 0, CSVREO_INDEX},
+   {"rows",     required_argument, 0, CSVREO_ROWS},
+   {"ordered",  no_argument,       0, CSVREO_ORDERED},
+   {"unordered", no_argument,      0, CSVREO_UNORDERED},
+   {"header",   no_argument,       0, CSVREO_HEADER},
+   {"io-uring", optional_argument, 0, CSVREO_URING},
+   {"sort-by",  required_argument, 0, CSVREO_SORT_BY},
+   {"sort-mem", required_argument, 0, CSVREO_SORT_MEM},
+   {"distinct", no_argument,       0, CSVREO_DISTINCT},
+   {"distinct-mem", required_argument, 0, CSVREO_DISTINCT_MEM},
+   {"format",   required_argument, 0, CSVREO_FORMAT},
    {0, 0, 0, 0}
 };
 
-//structure for each output file
-struct output_file
-{
-    FILE* outfile;                  //the file being written to
-    int* keyorder;                  //array of keys, in the specified order
-    size_t num_keys;                //number of keys selected (above array size)
-    struct output_file* next;       //next output file structure
-	short rev;						//reverse flag
-	short all;						//all flag
-    char outdelim;                  //delimiter for output
-    char outquote;                  //quote for output
-};
-
-struct data
-{
-    FILE* infile;                   //the input file
-    struct output_file* outputs;    //linked list of output file structures
-    size_t current_field;           //the current field being processed
-    size_t* field_lengths;          //the length of each field in the field array
-    size_t* field_capacity;         //the capacity of each field in the field array
-    char** field;                   //array of buffers for the parser
-	struct output_file* last;		//most recently allocated output struct
-	size_t row;						//number of rows read thus far
-    size_t progress;                //interval for progress messages
-	size_t num_fields;              //the number of columns in the file
-    char delim;                     //input file delimiter
-    char quote;                     //quote character
-};
-
-struct thread_data
-{
-	char *buff[2];
-	int status[2];
-	size_t size[2];			//used size of the buffer (not the capacity)
-	struct csv_parser* csv;	//pointer to the struct used by the parser
-	struct data* dat; 		//pointer to data struct used by callbacks
-
-};
-
-void usage(int code);
-void check_opts(struct data *o);
-void fileAssign(struct data *d, char *optarg);
-void keyAssign(struct data *d, char *optarg);
-void* thread_io_scan(void* data_ptr);
-
-/* callback functions */
-void cb1(void *, size_t, void *);
-void cb2(int, void *);
-
 int main(int argc, char** argv)
 {
-	clock_t begin = clock();
-
-	char ch;
-	struct data dat;
-	dat.infile = stdin;
-	dat.outputs = NULL;
-	dat.current_field = 0;
-	dat.row = 0;
-	dat.progress = DEFAULT_PROG;
-	dat.num_fields = 0;
-	dat.field_lengths = NULL;
-	dat.field_capacity = NULL;
-	dat.delim = '|';
-	dat.quote = '"';
-	dat.field = NULL;
-	dat.last = NULL;
-
-	//parse options
-	while((ch = getopt_long(argc, argv, "q:d:k:f:p:rahQ:D:K:f:P:RAH", long_options, NULL)) != -1)
-	{
-		switch(ch)
-		{
-			case 'q':
-				dat.quote = optarg[0];
-			case 'Q':
-				if(dat.last == NULL)
-				{
-					fileAssign(&dat, "");
-				}
-				dat.last->outquote = optarg[0];
-			break;
-
-			case 'd':
-				dat.delim = optarg[0];
-			case 'D':
-				if(dat.last == NULL)
-				{
-					fileAssign(&dat, "");
-				}
-				dat.last->outdelim = optarg[0];
-			break;
-
-			case 'p':
-			case 'P':
-				dat.progress = atoi(optarg);
-			break;
-
-			case 'k':
-			case 'K':
-				keyAssign(&dat, optarg);
-			break;
-
-			case 'f':
-			case 'F':
-				fileAssign(&dat, optarg);
-			break;
-
-			case 'r':
-			case 'R':
-				if(dat.last == NULL)
-				{
-					fileAssign(&dat, "");
-				}
-				dat.last->rev = true;
-			break;
-
-			case 'a':
-			case 'A':
-				if(dat.last == NULL)
-				{
-					fileAssign(&dat, "");
-				}
-				dat.last->all = true;
-			break;
-
-			case 'h':
-			case 'H':
-				usage(ERR_CODE_AOK);
-			break;
-		}
-	}
-
-	check_opts(&dat);
-
-	//initialize parser and buffers
-	struct csv_parser csv;
-	struct thread_data t_data;
-	t_data.buff[0] = malloc(sizeof(char) * BUFSIZE);
-	t_data.buff[1] = malloc(sizeof(char) * BUFSIZE);
-	t_data.status[0] = EMPTY;
-	t_data.status[1] = EMPTY;
-	t_data.size[0] = 0;
-	t_data.size[1] = 0;
-	t_data.csv = &csv;
-	t_data.dat = &dat;
-	pthread_t thread_id;
-	size_t c_count = 0;
+	struct csvreo* job = csvreo_new();
+	int ch;
+	int err;
 
-	csv_init(&csv, CSV_APPEND_NULL);
-
-	//set parser options
-	csv_set_quote(&csv, dat.quote);
-	if (csv_get_quote(&csv) != dat.quote)
+	if(job == NULL)
 	{
-		printf("cannot correctly set quote to %c\n", dat.quote);
-		exit(ERR_CODE_CSV);
+		fprintf(stderr, "ERROR: unable to allocate field buffers.\n");
+		exit(ERR_CODE_MEM);
 	}
 
-	csv_set_delim(&csv, dat.delim);
-	if (csv_get_delim(&csv) != dat.delim)
-	{
-		printf("cannot correctly set delimiter to %c\n", dat.delim);
-		exit(ERR_CODE_CSV);
-	}
-	
-	//fprintf(stderr, "data address: %p\n", &t_data);
+	//the library is quiet unless asked; the command line shows progress
+	//unless --progress 0 turns it off
+	csvreo_option(job, CSVREO_PROGRESS, "1");
 
-	//start thread
-	if(pthread_create(&thread_id, NULL, thread_io_scan, &t_data) != 0)
-	{
-		perror("ERROR while creating thread");
-	}
-
-	int idx;
-	int done = false;
-	//parse
-	while(!done)
+	//parse options
+	while((ch = getopt_long(argc, argv, "q:d:k:f:i:p:rahQ:D:K:F:I:P:RAH", long_options, NULL)) != -1)
 	{
-		for(idx = 0; idx < 2 && !done; ++idx)
+		if(ch == 'h' || ch == 'H')
 		{
-			if(t_data.status[idx] == EMPTY)
-			{
-				c_count = fread(t_data.buff[idx], 1, BUFSIZE, stdin);
-
-				if(c_count == BUFSIZE)
-				{
-					t_data.size[idx] = c_count;
-					t_data.status[idx] = FULL;
-					//fprintf(stderr, "marking %i FULL\n", idx);
-				}
-				else if(c_count > 0)
-				{
-					t_data.size[idx] = c_count;
-					t_data.status[idx] = FULL;
-					//fprintf(stderr, "marking %i FULL (short)\n", idx);
-					done = true;
-				}
-				else
-				{
-					t_data.status[idx] = DONE;
-					//fprintf(stderr, "marking %i DONE\n", idx);
-					done = true;
-				}
-			}
+			usage(ERR_CODE_AOK);
 		}
-	}
-
-	while((t_data.status[0] != DONE) && (t_data.status[1] != DONE))
-	{
-		for(idx = 0; idx < 2; ++idx)
+		else if(ch == '?')
 		{
-			if(t_data.status[idx] == EMPTY)
-			{
-				t_data.status[idx] = DONE;
-				//fprintf(stderr, "marking %i DONE\n", idx);
-			}
+			continue;
 		}
-	}
-
-	//fprintf(stderr, "joining...\n");
-	pthread_join(thread_id, NULL);
-	//fprintf(stderr, "joined\n");
-
-	//finish and free memory
-	csv_fini(&csv, cb1, cb2, &dat);
-	csv_free(&csv);
-
-	//maybe we should clean up the structures?
-
-	//fprintf(stderr, "Job complete, %i total records processed, %i bad records.\n", dat.row, dat.badRows);
-	fprintf(stderr, "Job complete, %zi total records processed.\n", dat.row);
-	fprintf(stderr, "Time taken: %.3f s\n", ((double)clock() - begin)/CLOCKS_PER_SEC);
-
-	return 0;
-}
-
-void cb1(void *c, size_t n, void *vp)
-{
-	struct data *d = vp;
-
-	//dynamically determine the number of columns, and initialize data
-	if(d->row == 0)
-	{
-		d->num_fields++;
-		d->field = realloc(d->field, d->num_fields*sizeof(char*));
-		d->field_capacity = realloc(d->field_capacity, d->num_fields*sizeof(size_t));
-		
-		d->field_lengths = realloc(d->field_lengths, d->num_fields*sizeof(size_t));
-		d->field_capacity[d->current_field] = n * sizeof(char);
-		d->field[d->current_field] = malloc(n * sizeof(char));
-	}
-	//if the string buffers are too small, allocate enough space
-	else if(n > d->field_capacity[d->current_field])
-	{
-		free(d->field[d->current_field]);
-		d->field[d->current_field] = malloc(n * sizeof(char));
-		d->field_capacity[d->current_field] = n * sizeof(char);
-	}
-	//copy string
-	memcpy(d->field[d->current_field], c, n);
-	d->field_lengths[d->current_field] = n;
-	d->current_field++;
-}
-
-void cb2(int n __attribute__ ((unused)), void *vp)
-{
-	struct data* d = vp;
 
-	/* maybe flag to suppress lines with incorrect number of fields
-	if(d->current_field != num_fields)
-	{
-		//do something based on options
+		err = csvreo_option(job, ch, optarg);
+		if(err != ERR_CODE_AOK)
+		{
+			fprintf(stderr, "ERROR: %s\n", csvreo_error(job));
+			exit(err);
+		}
 	}
-	*/
 
-	d->row++;
-
-	if(d->progress)
+	//the other arguments are more inputs
+	for(; optind < argc; ++optind)
 	{
-		if(!(d->row % d->progress))
+		err = csvreo_option(job, CSVREO_INPUT, argv[optind]);
+		if(err != ERR_CODE_AOK)
 		{
-			fprintf(stderr, "%zi records processed.\n", d->row);
+			fprintf(stderr, "ERROR: %s\n", csvreo_error(job));
+			exit(err);
 		}
 	}
 
-	size_t ndx;
-	struct output_file* output = d->outputs;
-	while(output != NULL)
+	err = csvreo_run(job);
+	if(err != ERR_CODE_AOK)
 	{
-		if(output->all == true)
-		{
-			csv_fwrite2(output->outfile,
-						d->field[0],
-						d->field_lengths[0],
-						output->outquote);
-			for(ndx = 1; ndx < d->num_fields; ++ndx)
-			{
-				fputc(output->outdelim, output->outfile);
-				csv_fwrite2(output->outfile,
-							d->field[ndx],
-							d->field_lengths[ndx],
-							output->outquote);
-			}
-		}
-		else if(output->rev == true)
-		{
-			csv_fwrite2(output->outfile,
-						d->field[d->num_fields - 1],
-						d->field_lengths[d->num_fields - 1],
-						output->outquote);
-			for(ndx = 2; ndx <= d->num_fields; ++ndx)
-			{
-				fputc(output->outdelim, output->outfile);
-				csv_fwrite2(output->outfile,
-							d->field[d->num_fields - ndx],
-							d->field_lengths[d->num_fields - ndx],
-							output->outquote);
-			}
-		}
-		else
-		{
-			csv_fwrite2(output->outfile,
-						d->field[output->keyorder[0]],
-						d->field_lengths[output->keyorder[0]],
-						output->outquote);
-			for(ndx = 1; ndx < output->num_keys; ++ndx)
-			{
-				fputc(output->outdelim, output->outfile);
-				csv_fwrite2(output->outfile,
-							d->field[output->keyorder[ndx]],
-							d->field_lengths[output->keyorder[ndx]],
-							output->outquote);
-			}
-		}
-		fputc('\n', output->outfile);
-		output = output->next;
+		fprintf(stderr, "ERROR: %s\n", csvreo_error(job));
+		exit(err);
 	}
-	d->current_field = 0;
+
+	//fprintf(stderr, "Job complete, %i total records processed, %i bad records.\n", dat.row, dat.badRows);
+	fprintf(stderr, "Job complete, %zi total records processed.\n", csvreo_rows(job));
+	fprintf(stderr, "Time taken: %.3f s\n", csvreo_time(job));
+	csvreo_report(job);
+	csvreo_free(job);
+
+	return 0;
 }
 
 void usage(int code)
@@ -447,8 +166,9 @@ void usage(int code)
    printf("* losing your file).                                 *\n");
    printf("*                                                    *\n");
    printf("* This function takes and reads a delimited file     *\n");
-   printf("* from stdin, and outputs a new file that has the    *\n");
-   printf("* specified fields in the specified order.           *\n");
+   printf("* from stdin (or --input), and outputs a new file    *\n");
+   printf("* that has the specified fields in the specified     *\n");
+   printf("* order.                                             *\n");
    printf("*                                                    *\n");
    printf("* Short options are not case-sensitive, unless       *\n");
    printf("* otherwise noted.                                   *\n");
@@ -473,6 +193,27 @@ void usage(int code)
    printf("*   repeatedly.                                      *\n");
    printf("*   Order sensitive (optional).                      *\n");
    printf("*                                                    *\n");
+   printf("* --input (-i) Reads the input from a file instead   *\n");
+   printf("*   of stdin.  Regular files are memory-mapped and   *\n");
+   printf("*   parsed without copying fields that need no       *\n");
+   printf("*   unescaping.                                      *\n");
+   printf("*   gzip and zstd input (from a file or stdin) is    *\n");
+   printf("*   recognized and decompressed by the reader.       *\n");
+   printf("*   Any number of inputs may be given, with -i or    *\n");
+   printf("*   after the options, and are read as one file.     *\n");
+   printf("*   Example:                                         *\n");
+   printf("*    -k2 -k5 -fout.csv shard_*.csv                   *\n");
+   printf("*                                                    *\n");
+   printf("* --ordered and --unordered With several inputs,     *\n");
+   printf("*   --threads of them are parsed at once.  Output    *\n");
+   printf("*   keeps the input order (--ordered, the default)   *\n");
+   printf("*   or is written as each input is parsed            *\n");
+   printf("*   (--unordered).                                   *\n");
+   printf("*                                                    *\n");
+   printf("* --header Skips the first record of every input     *\n");
+   printf("*   but the first, so shards that each repeat a      *\n");
+   printf("*   header row only write it once.                   *\n");
+   printf("*                                                    *\n");
    printf("* --file (-f) Specifies an output file. Any number   *\n");
    printf("*   of files (including 0, which defaults to stdout) *\n");
    printf("*   may be specified, each with its own key set,     *\n");
@@ -482,6 +223,68 @@ void usage(int code)
    printf("*   the file.                                        *\n");
    printf("*   Example:                                         *\n");
    printf("*    -ffilename1 -k3 -k4  -ffilename2 -k2 -k8        *\n");
+   printf("*   Files ending in .gz or .zst are compressed, in   *\n");
+   printf("*   independent blocks, by --compress-threads        *\n");
+   printf("*   threads per file.  zstd input and output need    *\n");
+   printf("*   a build with -DHAVE_ZSTD -lzstd.                 *\n");
+   printf("*                                                    *\n");
+   printf("* --where A test each row must pass to be written    *\n");
+   printf("*   to the file it follows (like -k).  N=value and   *\n");
+   printf("*   N!=value compare column N with value, N~prefix   *\n");
+   printf("*   and N!~prefix its start.  Values are compared    *\n");
+   printf("*   with quotes removed; N!= keeps non-empty         *\n");
+   printf("*   fields.  Every --where given must pass.  A       *\n");
+   printf("*   column past the end of a row is empty, so        *\n");
+   printf("*   N!=value keeps the row and N=value drops it.     *\n");
+   printf("*   Example:                                         *\n");
+   printf("*    -ftx.csv -a --where 4=TX --where 9~78           *\n");
+   printf("*                                                    *\n");
+   printf("* --partitions N and --partition-by K Split the file *\n");
+   printf("*   they follow into N files, picked by a hash of    *\n");
+   printf("*   column K (--partition-by may be repeated), so    *\n");
+   printf("*   rows with the same key share a file.  The file   *\n");
+   printf("*   name needs a %%d for the partition number.        *\n");
+   printf("*   Example:                                         *\n");
+   printf("*    -f'part_%%03d.csv' -a --partition-by 3           *\n");
+   printf("*    --partitions 64                                 *\n");
+   printf("*                                                    *\n");
+   printf("* --sort-by K[,K...] Sorts the rows of the file it   *\n");
+   printf("*   follows by columns K (of the input, byte by      *\n");
+   printf("*   byte, like sort in the C locale); rows with      *\n");
+   printf("*   equal keys keep the input order.  Rows are       *\n");
+   printf("*   sorted in runs that fit --sort-mem, spilled to   *\n");
+   printf("*   $TMPDIR (or /tmp) and merged at the end.         *\n");
+   printf("*   Example:                                         *\n");
+   printf("*    -fby_date.csv -k1 -k4 --sort-by 4,1             *\n");
+   printf("*                                                    *\n");
+   printf("* --sort-mem Memory the --sort-by files may use, in  *\n");
+   printf("*   all; K, M and G suffixes are accepted.  Default  *\n");
+   printf("*   is 256M.                                         *\n");
+   printf("*                                                    *\n");
+   printf("* --distinct Writes only the first of the rows of    *\n");
+   printf("*   the file it follows that are the same in every   *\n");
+   printf("*   column written.  Rows are checked by a hash of   *\n");
+   printf("*   those columns; once the hashes fill              *\n");
+   printf("*   --distinct-mem, rows not seen yet are spilled    *\n");
+   printf("*   to $TMPDIR (or /tmp) and checked at the end, so  *\n");
+   printf("*   those may come out after later rows.             *\n");
+   printf("*   Example:                                         *\n");
+   printf("*    -fcities.csv -k4 -k5 --distinct                 *\n");
+   printf("*                                                    *\n");
+   printf("* --distinct-mem Memory the --distinct files may     *\n");
+   printf("*   use, in all; K, M and G suffixes are accepted.   *\n");
+   printf("*   Default is 256M.                                 *\n");
+   printf("*                                                    *\n");
+   printf("* --format csv|lenprefix|columnar How the file it    *\n");
+   printf("*   follows is written.  lenprefix writes each row   *\n");
+   printf("*   as its field count and every field's length and  *\n");
+   printf("*   bytes; columnar writes chunks of rows a column   *\n");
+   printf("*   at a time, with the offset of every column, so   *\n");
+   printf("*   readers can pick columns and read chunks in      *\n");
+   printf("*   parallel.  Neither quotes anything; csvreo.h     *\n");
+   printf("*   describes both.  Default is csv.                 *\n");
+   printf("*   Example:                                         *\n");
+   printf("*    -fload.bin -k2 -k7 --format lenprefix           *\n");
    printf("*                                                    *\n");
    printf("* --help (-h) Displays this message and exits.       *\n");
    printf("*                                                    *\n");
@@ -489,9 +292,65 @@ void usage(int code)
    printf("*   keys (if supplied) are ignored.                  *\n");
    printf("*   This is not usable if files are specified.       *\n");
    printf("*                                                    *\n");
-   printf("* --progress (-p) After how many records to print a  *\n");
-   printf("*   progress message.  Default is %i            *\n", DEFAULT_PROG);
-   printf("*   0 turns this off.                                *\n");
+   printf("* --progress (-p) 0 turns progress messages off;     *\n");
+   printf("*   1, the default, prints them on a timer (see      *\n");
+   printf("*   below), and a larger count each time that many   *\n");
+   printf("*   more records are done; K and M suffixes are      *\n");
+   printf("*   accepted.  A background thread prints rows/s,    *\n");
+   printf("*   MB/s and, when the input size is known, percent  *\n");
+   printf("*   done and ETA.  SIGUSR1 prints one at once.       *\n");
+   printf("*                                                    *\n");
+   printf("* --progress-interval Time between progress          *\n");
+   printf("*   messages, in seconds; m and h suffixes are       *\n");
+   printf("*   accepted.  Default is 5s.                        *\n");
+   printf("*                                                    *\n");
+   printf("* --buffers Number of input buffers in the ring      *\n");
+   printf("*   shared by the reader and the parser (at least    *\n");
+   printf("*   2).  Default is %i.                               *\n", CSVREO_DEFAULT_BUFFERS);
+   printf("*                                                    *\n");
+   printf("* --bufsize Size of each input buffer; K, M and G    *\n");
+   printf("*   suffixes are accepted.  Default is 1M.           *\n");
+   printf("*                                                    *\n");
+   printf("* --threads Number of threads parsing the input in   *\n");
+   printf("*   parallel; 0 uses every processor.  The input is  *\n");
+   printf("*   split into --bufsize chunks at record boundaries *\n");
+   printf("*   and output keeps the input order.  Larger        *\n");
+   printf("*   buffers (e.g. 8M) work best.  --buffers is       *\n");
+   printf("*   raised to twice the thread count if needed.      *\n");
+   printf("*   Default is 1, or one per processor (up to one    *\n");
+   printf("*   per input) with several inputs.                  *\n");
+   printf("*                                                    *\n");
+   printf("* --io-uring[=direct] Reads a regular --input file   *\n");
+   printf("*   with io_uring, a read in flight for every free   *\n");
+   printf("*   buffer, instead of mapping it; =direct bypasses  *\n");
+   printf("*   the page cache (O_DIRECT) where the file system  *\n");
+   printf("*   allows.  Files are read the usual way where      *\n");
+   printf("*   io_uring is not available.                       *\n");
+   printf("*                                                    *\n");
+   printf("* --queue Number of 1M buffers of output each file's *\n");
+   printf("*   writer thread may fall behind by before parsing  *\n");
+   printf("*   waits for it; 0 writes from the parsing thread.  *\n");
+   printf("*   Default is %i.                                    *\n", CSVREO_DEFAULT_QUEUE);
+   printf("*                                                    *\n");
+   printf("* --compress-threads Number of threads compressing   *\n");
+   printf("*   each .gz or .zst output; 0 uses every            *\n");
+   printf("*   processor.  Default is 0.                        *\n");
+   printf("*                                                    *\n");
+   printf("* --build-index[=K] Writes INPUT.idx, the offset of  *\n");
+   printf("*   every Kth record of --input (default 65536).     *\n");
+   printf("*   Later runs on the same file use it to seek for   *\n");
+   printf("*   --rows and to split it for --threads at exact    *\n");
+   printf("*   record starts.  It is ignored once the file      *\n");
+   printf("*   changes.                                         *\n");
+   printf("*                                                    *\n");
+   printf("* --rows A:B Writes only records A to B (from 1);    *\n");
+   printf("*   either end may be left out.  Reading stops after *\n");
+   printf("*   B.  Parsed by one thread, from a single input.   *\n");
+   printf("*                                                    *\n");
+   printf("* --stats[=json] Prints time spent reading, parsing  *\n");
+   printf("*   and formatting for each output, bytes in and     *\n");
+   printf("*   out, buffer waits and peak buffer sizes to       *\n");
+   printf("*   stderr at the end, as text or as JSON.           *\n");
    printf("*                                                    *\n");
    printf("* Error Codes:                                       *\n");
    printf("*   These are the exit codes returned by this        *\n");
@@ -507,180 +366,10 @@ void usage(int code)
    printf("*   7: Equal quote and delimiter                     *\n");
    printf("*   8: Memory error                                  *\n");
    printf("*   9: File error                                    *\n");
+   printf("*  10: Thread error                                  *\n");
+   printf("*  11: Invalid option value                          *\n");
    printf("*                                                    *\n");
    printf("******************************************************\n\n");
 
    exit(code);
 }
-
-void check_opts(struct data *d)
-{
-	struct output_file* output = d->outputs;
-	if(isalnum(d->delim))
-	{
-		fprintf(stderr, "ERROR: %c is not a valid delimiter.\n", d->delim);
-		exit(ERR_CODE_BDD);
-	}
-
-	while(output != NULL)
-	{
-		if(isalnum(output->outdelim))
-		{
-			fprintf(stderr, "ERROR: %c is not a valid delimiter.\n", output->outdelim);
-			exit(ERR_CODE_BDD);
-		}
-		output = output->next;
-	}
-
-	if(isalnum(d->quote))
-	{
-		fprintf(stderr, "ERROR: %c is not a valid quote.\n", d->quote);
-		exit(ERR_CODE_BDQ);
-	}
-
-	output = d->outputs;
-	while(output != NULL)
-	{
-		if(isalnum(output->outquote))
-		{
-			fprintf(stderr, "ERROR: %c is not a valid quote.\n", output->outquote);
-			exit(ERR_CODE_BDQ);
-		}
-		output = output->next;
-	}
-
-	if(d->delim == d->quote)
-	{
-		fprintf(stderr, "ERROR: %c used as quote and delimiter.\n", d->quote);
-		exit(ERR_CODE_EQD);
-	}
-	
-	output = d->outputs;
-	while(output != NULL)
-	{
-		if(output->outdelim == output->outquote)
-		{
-			fprintf(stderr, "ERROR: %c used as quote and delimiter.\n", output->outquote);
-			exit(ERR_CODE_EQD);
-		}
-		output = output->next;
-	}
-	
-	output = d->outputs;
-	while(output != NULL)
-	{
-		if(output->num_keys == 0)
-		{
-			if((output->rev == false) && (output->all == false))
-			{
-				fprintf(stderr,"ERROR: no keys specified.\n");
-				exit(ERR_CODE_NKY);
-			}
-		}
-		output = output->next;
-	}
-}
-
-void fileAssign(struct data *d, char *optarg)
-{
-	//fprintf(stderr, "optarg to fileAssign: %s\n", optarg);
-	if(d->outputs == NULL)
-	{
-		d->outputs = malloc(sizeof(struct output_file));
-		d->last = d->outputs;
-	}
-	else
-	{
-		d->last->next = malloc(sizeof(struct output_file));
-		d->last = d->last->next;
-	}
-
-	if(strcmp(optarg, "") == 0)
-	{
-		d->last->outfile = stdout;
-	}
-	else
-	{
-		d->last->outfile = fopen(optarg, "w");
-	}
-
-	if(d->last->outfile == NULL)
-	{
-		fprintf(stderr, "ERROR: File %s failed to open.\n", optarg);
-		exit(ERR_CODE_FIL);
-	}
-
-	d->last->keyorder = NULL;
-	d->last->num_keys = 0;
-	d->last->outdelim = d->delim;
-	d->last->outquote = d->quote;
-	d->last->rev = false;
-	d->last->all = false;
-	d->last->next = NULL;
-
-	//fprintf(stderr, "leaving fileAssign: %s\n", optarg);
-}
-
-void keyAssign(struct data *d, char *optarg)
-{
-	int new_key = atoi(optarg);
-	//fprintf(stderr, "new key: %i\n", new_key);
-
-	if(new_key < 1)
-	{
-		fprintf(stderr, "ERROR: key value %i is too low\n", new_key);
-		exit(ERR_CODE_KOR);
-	}
-
-	if(d->outputs == NULL)
-	{
-		fileAssign(d, "");
-	}
-
-	--new_key;
-	
-	d->last->num_keys++;
-	d->last->keyorder = realloc(d->last->keyorder, d->last->num_keys * sizeof(int));
-	d->last->keyorder[(d->last->num_keys) - 1] = new_key;
-}
-
-void* thread_io_scan(void* data_ptr)
-{
-	//fprintf(stderr, "thread started\n");
-	struct thread_data* data = (struct thread_data*)data_ptr;
-
-	//fprintf(stderr, "thread: data address: %p\n", data);
-
-	while((data->status[0] != DONE) && (data->status[1] != DONE))
-	{
-		if(data->status[0] == FULL)
-		{
-			//fprintf(stderr, "thread: found buffer 0 FULL; marking busy\n");
-			data->status[0] = BUSY;
-			csv_parse(data->csv, data->buff[0], data->size[0], cb1, cb2, data->dat);
-			if(csv_error(data->csv))
-			{
-				printf("ERROR: CSV-%s\n", csv_strerror(csv_error(data->csv)));
-				exit(ERR_CODE_CSV);
-			}
-			//fprintf(stderr, "thread: finished buffer 0; marking EMPTY\n");
-			data->status[0] = EMPTY;
-		}
-		if(data->status[1] == FULL)
-		{
-			//fprintf(stderr, "thread: found buffer 1 FULL; marking busy\n");
-			data->status[1] = BUSY;
-			csv_parse(data->csv, data->buff[1], data->size[1], cb1, cb2, data->dat);
-			if(csv_error(data->csv))
-			{
-				printf("ERROR: CSV-%s\n", csv_strerror(csv_error(data->csv)));
-				exit(ERR_CODE_CSV);
-			}
-			//fprintf(stderr, "thread: finished buffer 1; marking EMPTY\n");
-			data->status[1] = EMPTY;
-		}
-	}
-	//fprintf(stderr, "thread finished\n");
-	
-	return NULL;
-}